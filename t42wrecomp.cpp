@@ -1,7 +1,9 @@
 #include <vector>
 #include <string>
+#include <map>
 #include <memory>
 #include <utility>
+#include <algorithm>
 #include <cwctype>
 #include "t42wregex.hpp"
 
@@ -10,53 +12,24 @@ namespace wpike {
 
 typedef std::wstring::iterator derivs_t;
 
-bool scan (derivs_t& sp0, std::wstring pat, std::vector<derivs_t>& m)
+// skip the literal string t from p.
+static bool literal (derivs_t& p, wchar_t const* t)
 {
-    m.clear ();
-    derivs_t sp = sp0;
-    derivs_t ip = pat.begin ();
-    while (ip < pat.end ()) {
-        int lo = 0, hi = 0, n1 = 1, n2 = 1;
-        wchar_t c = *ip++;
-        if (L'(' == c || L')' == c)
-            m.push_back (sp);
-        else {
-            bool dot = L'.' == c;
-            if (L'%' == c) {
-                c = *ip++;
-                lo = L'a' == c ? 10 : lo;
-                hi = L'o' == c ? 10 : L'd' == c ? 10 : L'x' == c ? 16 : (L'l' == c || L'a' == c) ? 36 : hi;
-            }
-            if (ip + 4 < pat.end () && L'{' == *ip && L',' == ip[2] && L'}' == ip[4])
-                n1 = c7toi (ip[1]), n2 = c7toi (ip[3]), ip += 5;
-            for (int i = 0; i < n2; ++i, ++sp) {
-                int x = L'\0' != *sp ? c7toi (*sp) : L'\0';
-                if (dot || (hi == 0 && c == *sp) || (lo <= x && x < hi))
-                    continue;
-                if (i < n1)
-                    return false;
-                break;
-            }
-        }
-    }
-    sp0 = sp;
+    derivs_t q = p;
+    for (; L'\0' != *t; ++t, ++q)
+        if (*q != *t)
+            return false;
+    p = q;
     return true;
 }
 
-bool scan (derivs_t& p, std::wstring pat)
+// the number of digits in the base from p up to n.
+static int ndigits (derivs_t p, int const base, int const n)
 {
-    std::vector<derivs_t> _;
-    return scan (p, pat, _);
-}
-
-bool scan_not (derivs_t& p, std::wstring pat, std::wstring la)
-{
-    derivs_t q = p;
-    if (scan (q, pat) && ! scan (q, la)) {
-        p = q;
-        return true;
-    }
-    return false;
+    int i = 0;
+    while (i < n && c7toi (p[i]) < base)
+        ++i;
+    return i;
 }
 
 template<typename T>
@@ -70,52 +43,110 @@ bool scan_digits (derivs_t& p, int const base, int const len, T& x)
     return true;
 }
 
+// the kinds of factors told by their lead characters.
+enum token {
+    TOKEN_CHAR, TOKEN_GROUP, TOKEN_CCLASS, TOKEN_ANY, TOKEN_BOL, TOKEN_EOL,
+    TOKEN_BOS, TOKEN_EOS, TOKEN_WORDB, TOKEN_NWORDB, TOKEN_BSNAME, TOKEN_BKREF
+};
+
+// tokens of ASCII characters, and those after a backslash.
+struct token_table {
+    unsigned char lead[128];
+    unsigned char escape[128];
+
+    token_table ()
+    {
+        static wchar_t const bsname[] = L"dswDSW";
+        std::fill (lead, lead + 128, TOKEN_CHAR);
+        std::fill (escape, escape + 128, TOKEN_CHAR);
+        lead[L'('] = TOKEN_GROUP;
+        lead[L'['] = TOKEN_CCLASS;
+        lead[L'.'] = TOKEN_ANY;
+        lead[L'^'] = TOKEN_BOL;
+        lead[L'$'] = TOKEN_EOL;
+        escape[L'A'] = TOKEN_BOS;
+        escape[L'z'] = TOKEN_EOS;
+        escape[L'b'] = TOKEN_WORDB;
+        escape[L'B'] = TOKEN_NWORDB;
+        for (wchar_t const* q = bsname; L'\0' != *q; ++q)
+            escape[*q] = TOKEN_BSNAME;
+        for (wchar_t c = L'1'; c <= L'9'; ++c)
+            escape[c] = TOKEN_BKREF;
+    }
+};
+
+// the probes of tokens. factor () looks up the token () of the lead
+// characters to try its probe, and falls back to regchar () when it fails.
+// a derived lexer changing the lead characters overrides token () too.
 struct vmlex {
     vmlex () {}
     virtual ~vmlex () {}
     virtual bool endstring (derivs_t& p) { return L'\0' == *p; }
-    virtual bool alt (derivs_t& p) { return scan (p, L"|"); }
-    virtual bool rep01 (derivs_t& p) { return scan (p, L"?"); }
-    virtual bool rep0 (derivs_t& p) { return scan (p, L"*"); }
-    virtual bool rep1 (derivs_t& p) { return scan (p, L"+"); }
-    virtual bool ngreedy (derivs_t& p) { return scan (p, L"?"); }
-    virtual bool any (derivs_t& p) { return scan (p, L"%."); }
-    virtual bool bol (derivs_t& p) { return scan (p, L"^"); }
-    virtual bool eol (derivs_t& p) { return scan (p, L"$"); }
-    virtual bool bos (derivs_t& p) { return scan (p, L"\\A"); }
-    virtual bool eos (derivs_t& p) { return scan (p, L"\\z"); }
-    virtual bool wordb (derivs_t& p) { return scan (p, L"\\b"); }
-    virtual bool nwordb (derivs_t& p) { return scan (p, L"\\B"); }
+    virtual bool alt (derivs_t& p) { return literal (p, L"|"); }
+    virtual bool rep01 (derivs_t& p) { return literal (p, L"?"); }
+    virtual bool rep0 (derivs_t& p) { return literal (p, L"*"); }
+    virtual bool rep1 (derivs_t& p) { return literal (p, L"+"); }
+    virtual bool ngreedy (derivs_t& p) { return literal (p, L"?"); }
+    virtual bool any (derivs_t& p) { return literal (p, L"."); }
+    virtual bool bol (derivs_t& p) { return literal (p, L"^"); }
+    virtual bool eol (derivs_t& p) { return literal (p, L"$"); }
+    virtual bool bos (derivs_t& p) { return literal (p, L"\\A"); }
+    virtual bool eos (derivs_t& p) { return literal (p, L"\\z"); }
+    virtual bool wordb (derivs_t& p) { return literal (p, L"\\b"); }
+    virtual bool nwordb (derivs_t& p) { return literal (p, L"\\B"); }
     virtual bool first_group (derivs_t& p) { return L'(' == *p; }
-    virtual bool group (derivs_t& p) { return scan_not (p, L"%(", L"?"); }
-    virtual bool lparen (derivs_t& p) { return scan (p, L"%(?:"); }
-    virtual bool lkahead (derivs_t& p) { return scan (p, L"%(?="); }
-    virtual bool nlkahead (derivs_t& p) { return scan (p, L"%(?!"); }
-    virtual bool lkbehind (derivs_t& p) { return scan (p, L"%(?<="); }
-    virtual bool nlkbehind (derivs_t& p) { return scan (p, L"%(?<!"); }
-    virtual bool gcomment (derivs_t& p) { return scan (p, L"%(?#"); }
-    virtual bool gnest (derivs_t& p) { return scan (p, L"%(?*"); }
-    virtual bool rparen (derivs_t& p) { return scan (p, L"%)"); }
-    virtual bool cclass (derivs_t& p) { return scan (p, L"["); }
-    virtual bool ncclass (derivs_t& p) { return scan (p, L"^"); }
-    virtual bool rcclass (derivs_t& p) { return scan (p, L"]"); }
-    virtual bool range (derivs_t& p) { return scan (p, L"-"); }
+    virtual bool group (derivs_t& p) { return L'?' != p[1] && literal (p, L"("); }
+    virtual bool lparen (derivs_t& p) { return literal (p, L"(?:"); }
+    virtual bool lkahead (derivs_t& p) { return literal (p, L"(?="); }
+    virtual bool nlkahead (derivs_t& p) { return literal (p, L"(?!"); }
+    virtual bool lkbehind (derivs_t& p) { return literal (p, L"(?<="); }
+    virtual bool nlkbehind (derivs_t& p) { return literal (p, L"(?<!"); }
+    virtual bool gcomment (derivs_t& p) { return literal (p, L"(?#"); }
+    virtual bool gnest (derivs_t& p) { return literal (p, L"(?*"); }
+    virtual bool rparen (derivs_t& p) { return literal (p, L")"); }
+    virtual bool cclass (derivs_t& p) { return literal (p, L"["); }
+    virtual bool ncclass (derivs_t& p) { return literal (p, L"^"); }
+    virtual bool rcclass (derivs_t& p) { return literal (p, L"]"); }
+    virtual bool range (derivs_t& p) { return literal (p, L"-"); }
+
+    virtual int token (derivs_t& p)
+    {
+        static token_table const table;
+        unsigned long const c = p[0];
+        if (c >= 128)
+            return TOKEN_CHAR;
+        if (L'\\' != c)
+            return table.lead[c];
+        unsigned long const c1 = p[1];
+        return c1 < 128 ? table.escape[c1] : TOKEN_CHAR;
+    }
 
+    // '{' [0-9]{1,8} '}' / '{' [0-9]{1,8} ',' [0-9]{0,8} '}'
     virtual bool repnn (derivs_t& p, int& n1, int& n2)
     {
-        std::vector<derivs_t> m;
-        if (scan (p, L"%{(%d{1,8})%}", m)) {
-            scan_digits (m[0], 10, 8, n1);
+        if (L'{' != *p)
+            return false;
+        derivs_t m1 = p + 1;
+        derivs_t q = m1 + ndigits (m1, 10, 8);
+        if (q == m1)
+            return false;
+        if (L'}' == *q) {
+            scan_digits (m1, 10, 8, n1);
             n2 = n1;
+            p = q + 1;
             return true;
         }
-        else if (scan (p, L"%{(%d{1,8}),(%d{0,8})%}", m)) {
-            n2 = -1;
-            scan_digits (m[0], 10, 8, n1);
-            scan_digits (m[2], 10, 8, n2);
-            return true;
-        }
-        return false;
+        if (L',' != *q)
+            return false;
+        derivs_t m2 = q + 1;
+        q = m2 + ndigits (m2, 10, 8);
+        if (L'}' != *q)
+            return false;
+        n2 = -1;
+        scan_digits (m1, 10, 8, n1);
+        scan_digits (m2, 10, 8, n2);
+        p = q + 1;
+        return true;
     }
 
     virtual bool bsname (derivs_t& p, std::wstring& t)
@@ -141,27 +172,46 @@ struct vmlex {
         return false;
     }
 
+    // '\\c' . / '\\' [0-7] [0-9]{0,3} / '\\x' [0-9a-f]{1,2} / '\\x{' [0-9a-f]{1,8} '}'
+    // / '\\u' [0-9a-f]{4} / '\\U' [0-9a-f]{8} / '\\'? .
+    // an octal escape takes up to 4 digits, and its value is of octal ones.
     virtual bool regchar (derivs_t& p, wchar_t& c)
     {
         static const std::wstring ctrlname (L"aftnrv");
         static const std::wstring ctrlchar (L"\a\f\t\n\r\v");
         std::wstring::size_type i;
-        std::vector<derivs_t> m;
-        if (scan (p, L"\\c.")) {
+        int n;
+        bool const bs = L'\\' == *p;
+        derivs_t m = p + 2;
+        if (bs && L'c' == p[1]) {
+            p += 3;
             if (std::iswcntrl (p[-1]))
                 return false;
             c = p[-1] % 32;
         }
-        else if (scan (p, L"\\(%o{1,4})", m))
-            scan_digits (m[0], 8, 4, c);
-        else if (scan (p, L"\\x(%x{1,2})", m))
-            scan_digits (m[0], 16, 2, c);
-        else if (scan (p, L"\\x%{(%x{1,8})%}", m))
-            scan_digits (m[0], 16, 8, c);
-        else if (scan (p, L"\\u(%x{4,4})", m))
-            scan_digits (m[0], 16, 4, c);
-        else if (scan (p, L"\\U(%x{8,8})", m))
-            scan_digits (m[0], 16, 8, c);
+        else if (bs && c7toi (p[1]) < 8) {
+            m = p + 1;
+            p = m + ndigits (m, 10, 4);
+            scan_digits (m, 8, 4, c);
+        }
+        else if (bs && L'x' == p[1] && (n = ndigits (m, 16, 2)) > 0) {
+            p = m + n;
+            scan_digits (m, 16, 2, c);
+        }
+        else if (bs && L'x' == p[1] && L'{' == p[2] && (n = ndigits (m + 1, 16, 8)) > 0
+                && L'}' == m[1 + n]) {
+            p = m + n + 2;
+            ++m;
+            scan_digits (m, 16, 8, c);
+        }
+        else if (bs && L'u' == p[1] && ndigits (m, 16, 4) == 4) {
+            p = m + 4;
+            scan_digits (m, 16, 4, c);
+        }
+        else if (bs && L'U' == p[1] && ndigits (m, 16, 8) == 8) {
+            p = m + 8;
+            scan_digits (m, 16, 8, c);
+        }
         else {
             c = *p++;
             if (std::iswcntrl (c))
@@ -177,14 +227,22 @@ struct vmlex {
         return true;
     }
 
+    // '[:' '^'? [a-z]{1,35} ':]'
     virtual bool posixname (derivs_t& p, std::wstring& t)
     {
-        std::vector<derivs_t> m;
-        if (scan (p, L"[:(^{0,1}%a{1,z}):]", m)) {
-            t.assign (m[0], m[1]);
-            return true;
-        }
-       return false;
+        if (L'[' != p[0] || L':' != p[1])
+            return false;
+        derivs_t const m = p + 2;
+        derivs_t q = L'^' == *m ? m + 1 : m;
+        int n = 0;
+        while (n < 35 && 10 <= c7toi (q[n]) && c7toi (q[n]) < 36)
+            ++n;
+        q += n;
+        if (n == 0 || L':' != q[0] || L']' != q[1])
+            return false;
+        t.assign (m, q);
+        p = q + 2;
+        return true;
     }
 
     virtual bool first_term (derivs_t& p)
@@ -195,51 +253,173 @@ struct vmlex {
     virtual bool first_factor (derivs_t& p)
     {
         std::wstring _;
-        return L'?' != *p && L'*' != *p && L'+' != *p && ! posixname (p, _);
+        derivs_t q = p;
+        return L'?' != *p && L'*' != *p && L'+' != *p && ! posixname (q, _);
     }
 };
 
+// the syntax tree of a pattern lives in an arena. a node refers to
+// its first child and its next sibling by indices in the arena, -1 for
+// none. the parser appends a node after its children, so that children
+// always have smaller indices than their parents.
+//
+//  LEAF    op is the instruction
+//  CAT     children are the terms
+//  ALT     children are the alternatives in priority order
+//  REPEAT  op is REP m,n,%r of the child, ngreedy for the lazy one
+//  GROUP   op is SAVE 2*n,2*n+1 around the child
+//  LOOK    op is LKAHEAD, NLKAHEAD, LKBEHIND, or NLKBEHIND of the child
+//  NEST    op is RESET %r, children are lefttok, righttok, and e1
+struct astnode {
+    enum kind_type {LEAF, CAT, ALT, REPEAT, GROUP, LOOK, NEST};
+    kind_type kind;
+    instruction op;
+    bool ngreedy;
+    int child;
+    int next;
+    int size;   // the number of instructions emitted
+
+    astnode (kind_type k, instruction const& i, int c)
+        : kind (k), op (i), ngreedy (false), child (c), next (-1), size (0) {}
+};
+
 struct compenv {
     bool behind;
 };
 
 class vmcompiler {
 public:
-    vmcompiler (std::shared_ptr<vmlex> const& a) : lex (a) {}
+    vmcompiler (std::shared_ptr<vmlex> const& a) : lex (a), keepall (true) {}
+    void keep (std::vector<int> const& groups) { keepall = false, kept = groups; }
     bool exp (derivs_t& p, program& e);
+    void reverse (suffix& sfx);
 private:
     std::shared_ptr<vmlex> lex;
+    std::vector<astnode> ast;
+    int root;
+    bool keepall;
+    std::vector<int> kept;
+    std::vector<char> saved;    // saved[n] for the group n to emit SAVE
     int mgroup;
     int mreg;
-    bool alt (derivs_t& p, compenv& a, program& e);
-    bool cat (derivs_t& p, compenv& a, program& e);
-    bool term (derivs_t& p, compenv& a, program& e);
-    bool factor (derivs_t& p, compenv& a, program& e);
-    bool group (derivs_t& p, compenv& a, program& e);
-    bool gnest (derivs_t& p, compenv& a, program& e);
+    bool backward;  // parsing in a lookbehind, where cat is emitted reversed
+    int node (astnode::kind_type kind, instruction const& op, int child);
+    int link (std::vector<int> const& v, astnode::kind_type kind);
+    int head (int x);
+    operation anchor (int x);
+    std::vector<int> trie (std::vector<int> const& v);
+    bool alt (derivs_t& p, int& x);
+    bool cat (derivs_t& p, int& x);
+    bool term (derivs_t& p, int& x);
+    bool factor (derivs_t& p, int& x);
+    bool group (derivs_t& p, int& x);
+    bool gnest (derivs_t& p, int& x);
     bool gcomment (derivs_t& p);
-    bool cclass (derivs_t& p, compenv& a, program& e);
-    bool csetname (derivs_t& p, compenv& a, std::wstring& span);
-    bool clschar (derivs_t& p, compenv& a, std::wstring& span);
+    bool cclass (derivs_t& p, int& x);
+    bool csetname (derivs_t& p, std::wstring& span);
+    bool clschar (derivs_t& p, std::wstring& span);
     bool encode_posixname (std::wstring name, std::wstring& s);
+    void measure ();
+    void emit (int n, compenv const& a, program& e);
 };
 
 // exp <- alt ENDSTR
 //
 //      e
 //      MATCH
+//
+// the parser builds the tree, and the emitter writes the program at once.
 bool vmcompiler::exp (derivs_t& p, program& e)
 {
     compenv a;
     a.behind = false;
+    int x;
+    ast.clear ();
     mgroup = 0;
     mreg = 0;
-    if (! (alt (p, a, e) && lex->endstring (p)))
+    backward = false;
+    if (! (alt (p, x) && lex->endstring (p)))
         return false;
+    root = x;
+    saved.assign (mgroup + 1, keepall);
+    for (int n : kept)
+        if (0 < n && n <= mgroup)
+            saved[n] = true;
+    for (auto const& t : ast)
+        if (BKREF == t.op.opcode && t.op.x <= mgroup)
+            saved[t.op.x] = true;
+    measure ();
+    e.reserve (e.size () + ast[x].size + 1);
+    emit (x, a, e);
     e.push_back (instruction (MATCH));
     return true;
 }
 
+// the reverse program when every match of the pattern ends at \z or $.
+// backreferences and nested parentheses patterns are not reversed.
+void vmcompiler::reverse (suffix& sfx)
+{
+    sfx.rev.clear ();
+    sfx.eol = false;
+    for (auto const& t : ast)
+        if (astnode::NEST == t.kind || BKREF == t.op.opcode)
+            return;
+    operation const op = anchor (root);
+    if (EOS != op && EOL != op)
+        return;
+    compenv a;
+    a.behind = true;
+    sfx.rev.reserve (ast[root].size + 1);
+    emit (root, a, sfx.rev);
+    sfx.rev.push_back (instruction (MATCH));
+    sfx.eol = EOL == op;
+}
+
+// EOS or EOL when the last term of every alternative of x is one of them,
+// EOL when any of them is $, or MATCH otherwise.
+operation vmcompiler::anchor (int x)
+{
+    astnode const& t = ast[x];
+    operation op = MATCH;
+    switch (t.kind) {
+    case astnode::LEAF:
+        return EOS == t.op.opcode || EOL == t.op.opcode ? t.op.opcode : MATCH;
+    case astnode::CAT:
+        for (int c = t.child; c >= 0; c = ast[c].next)
+            if (ast[c].next < 0)
+                return anchor (c);
+        return MATCH;
+    case astnode::ALT:
+        for (int c = t.child; c >= 0; c = ast[c].next) {
+            operation const y = anchor (c);
+            if (MATCH == y)
+                return MATCH;
+            op = EOL == y ? EOL : MATCH == op ? EOS : op;
+        }
+        return op;
+    case astnode::GROUP:
+        return anchor (t.child);
+    default:
+        return MATCH;
+    }
+}
+
+int vmcompiler::node (astnode::kind_type kind, instruction const& op, int child)
+{
+    ast.push_back (astnode (kind, op, child));
+    return ast.size () - 1;
+}
+
+// the node of kind over the siblings v, or the only one of them.
+int vmcompiler::link (std::vector<int> const& v, astnode::kind_type kind)
+{
+    if (v.size () == 1)
+        return v[0];
+    for (std::size_t i = 1; i < v.size (); ++i)
+        ast[v[i - 1]].next = v[i];
+    return node (kind, instruction (MATCH), v.empty () ? -1 : v[0]);
+}
+
 // alt <- cat ('|' cat)*
 //
 // instructions SPLIT and JMP have relative address displacements
@@ -254,31 +434,86 @@ bool vmcompiler::exp (derivs_t& p, program& e)
 //   L4 SPLIT   L5,L6
 //   L5 e3
 //   L6
-bool vmcompiler::alt (derivs_t& p, compenv& a, program& e)
+bool vmcompiler::alt (derivs_t& p, int& x)
 {
-    std::vector<std::size_t> patch;
-    program lhs;
-    if (! cat (p, a, lhs))
+    std::vector<int> v;
+    if (! cat (p, x))
         return false;
+    v.push_back (x);
     while (lex->alt (p)) {
-        program rhs;
-        if (! cat (p, a, rhs))
+        if (! cat (p, x))
             return false;
-        if (lhs.empty () && rhs.empty ())
-            continue;
-        e.push_back (instruction (SPLIT, 0, lhs.size () + 1, 0));
-        e.insert (e.end (), lhs.begin (), lhs.end ());
-        patch.push_back (e.size ());
-        e.push_back (instruction (JMP, 0, 0, 0));
-        lhs = std::move (rhs);
+        v.push_back (x);
     }
-    e.insert (e.end (), lhs.begin (), lhs.end ());
-    std::size_t const dot = e.size ();
-    for (auto i : patch)
-        e[i].x = dot - i - 1;
+    x = link (trie (v), astnode::ALT);
     return true;
 }
 
+// the first term of the alternative x when it is a character or a class.
+int vmcompiler::head (int x)
+{
+    int const t = astnode::CAT == ast[x].kind ? ast[x].child : x;
+    if (t < 0 || astnode::LEAF != ast[t].kind)
+        return -1;
+    operation const op = ast[t].op.opcode;
+    return CHAR == op || CCLASS == op || NCCLASS == op || ANY == op ? t : -1;
+}
+
+// factor alternatives with the same first term into a prefix trie, so
+// that keywords spawn threads along the depth of the trie instead of one
+// for each of them. an alternative led by a character moves up over those
+// led by the other characters, since no two of them match at a position.
+// it stops at the others to keep the priority of alternatives.
+// in a lookbehind, the first character is matched last, so that two of
+// them may match, and only the neighbours are factored.
+//
+//  alpha|beta|alpine       a(?:lp(?:ha|ine))|beta
+std::vector<int> vmcompiler::trie (std::vector<int> const& v0)
+{
+    std::vector<std::vector<int>> bucket;
+    std::map<wchar_t, std::size_t> lead;
+    for (int x : v0) {
+        int const c = head (x);
+        if (c < 0 || CHAR != ast[c].op.opcode || backward) {
+            bucket.push_back (std::vector<int>{x});
+            lead.clear ();
+            continue;
+        }
+        wchar_t const k = std::towlower (ast[c].op.s[0]);
+        auto const i = lead.find (k);
+        if (i != lead.end ())
+            bucket[i->second].push_back (x);
+        else {
+            lead[k] = bucket.size ();
+            bucket.push_back (std::vector<int>{x});
+        }
+    }
+    std::vector<int> v;
+    for (auto const& b : bucket)
+        v.insert (v.end (), b.begin (), b.end ());
+    std::vector<int> u;
+    for (std::size_t i = 0, j; i < v.size (); i = j) {
+        int const c = head (v[i]);
+        for (j = i + 1; c >= 0 && j < v.size (); ++j) {
+            int const d = head (v[j]);
+            if (d < 0 || ast[c].op.opcode != ast[d].op.opcode || ast[c].op.s != ast[d].op.s)
+                break;
+        }
+        if (j - i < 2) {
+            j = i + 1;
+            u.push_back (v[i]);
+            continue;
+        }
+        std::vector<int> rest;
+        for (std::size_t k = i; k < j; ++k)
+            rest.push_back (node (astnode::CAT, instruction (MATCH), ast[head (v[k])].next));
+        int const x = link (trie (rest), astnode::ALT);
+        ast[c].next = -1;
+        u.push_back (link (std::vector<int>{c, x}, astnode::CAT));
+    }
+    return u;
+}
+
 // cat <- term*
 //
 //  e1 e2           where d > 0 outside LOOKBEHIND or inside LOOKAHEAD
@@ -288,17 +523,15 @@ bool vmcompiler::alt (derivs_t& p, compenv& a, program& e)
 //  (?<= e1 e2)     where d < 0 inside LOOKBEHIND
 //      e2
 //      e1
-bool vmcompiler::cat (derivs_t& p, compenv& a, program& e)
+bool vmcompiler::cat (derivs_t& p, int& x)
 {
+    std::vector<int> v;
     while (lex->first_term (p)) {
-        program e1;
-        if (! term (p, a, e1))
+        if (! term (p, x))
             return false;
-        if (a.behind)
-            e.insert (e.begin (), e1.begin (), e1.end ());
-        else
-            e.insert (e.end (), e1.begin (), e1.end ());
+        v.push_back (x);
     }
+    x = link (v, astnode::CAT);
     return true;
 }
 
@@ -327,12 +560,11 @@ bool vmcompiler::cat (derivs_t& p, compenv& a, program& e)
 //   L2 e                        L2 e
 //      JMP   L1                    JMP   L1
 //   L3                          L3
-bool vmcompiler::term (derivs_t& p, compenv& a, program& e)
+bool vmcompiler::term (derivs_t& p, int& x)
 {
-    program e1;
     int k1 = 1, k2 = 1;
     bool ngreedy = false;
-    if (! factor (p, a, e1))
+    if (! factor (p, x))
         return false;
     if (lex->rep01 (p)) {
         k1 = 0, k2 = 1;
@@ -349,29 +581,13 @@ bool vmcompiler::term (derivs_t& p, compenv& a, program& e)
     else if (lex->repnn (p, k1, k2)) {
         ngreedy = lex->ngreedy (p);
     }
-    int n1 = e1.size ();
-    int x = k1 == 1 && k2 == -1 ? -(n1 + 1) : 0;
-    int y = k1 == 0 && k2 == 1 ? n1 : k1 == 1 && k2 == -1 ? 0 : n1 + 1;
-    if (k1 != k2 && ngreedy)
-        std::swap (x, y);
     if (k1 == 1 && k2 == 1)
-        e.insert (e.end (), e1.begin (), e1.end ());
-    else if (k1 == 1 && k2 == -1) {
-        e.insert (e.end (), e1.begin (), e1.end ());
-        e.push_back (instruction (SPLIT, x, y, 0));
-    }
-    else {
-        int z = k1 == 0 && k2 == -1 ? -(n1 + 2) : -(n1 + 3);
-        if (! (k1 == 0 && (k2 == 1 || k2 == -1))) {
-            int const r = mreg++;
-            e.push_back (instruction (RESET, 0, 0, r));
-            e.push_back (instruction (REP, k1, k2, r));
-        }
-        e.push_back (instruction (SPLIT, x, y, 0));
-        e.insert (e.end (), e1.begin (), e1.end ());
-        if (! (k1 == 0 && k2 == 1))
-            e.push_back (instruction (JMP, z, 0, 0));
-    }
+        return true;
+    int r = 0;
+    if (! (k1 == 1 && k2 == -1) && ! (k1 == 0 && (k2 == 1 || k2 == -1)))
+        r = mreg++;
+    x = node (astnode::REPEAT, instruction (REP, k1, k2, r), x);
+    ast[x].ngreedy = ngreedy;
     return true;
 }
 
@@ -391,51 +607,66 @@ bool vmcompiler::term (derivs_t& p, compenv& a, program& e)
 //     CCLASS ":q"         CCLASS ":u"          CCLASS ":x"
 //
 // \1
-//     BKREF  1
-bool vmcompiler::factor (derivs_t& p, compenv& a, program& e)
+//     BKREF  1         compares the captured slice at once
+bool vmcompiler::factor (derivs_t& p, int& x)
 {
     std::wstring name;
     int n;
     wchar_t c;
+    operation op = CHAR;
     if (! lex->first_factor (p))
         return false;
-    else if (lex->first_group (p)) {
-        if (! group (p, a, e))
-            return false;
-    }
-    else if (lex->cclass (p)) {
-        if (! cclass (p, a, e))
-            return false;
-    }
-    else if (lex->any (p))
-        e.push_back (instruction (ANY));
-    else if (lex->bol (p))
-        e.push_back (instruction (BOL));
-    else if (lex->eol (p))
-        e.push_back (instruction (EOL));
-    else if (lex->bos (p))
-        e.push_back (instruction (BOS));
-    else if (lex->eos (p))
-        e.push_back (instruction (EOS));
-    else if (lex->wordb (p))
-        e.push_back (instruction (WORDB));
-    else if (lex->nwordb (p))
-        e.push_back (instruction (NWORDB));
-    else if (lex->bsname (p, name)) {
-        std::wstring s;
-        encode_posixname (name, s);
-        e.push_back (instruction (CCLASS, s));
-    }
-    else if (lex->bkref (p, n)) {
-        int const r = mreg++;
-        e.push_back (instruction (RESET, 0, 0, r));
-        e.push_back (instruction (BKREF, n, 0, r));
-    }
-    else {
-        if (! lex->regchar (p, c))
-            return false;
-        e.push_back (instruction (CHAR, std::wstring (1, c)));
+    switch (lex->token (p)) {
+    case TOKEN_GROUP:
+        if (lex->first_group (p))
+            return group (p, x);
+        break;
+    case TOKEN_CCLASS:
+        if (lex->cclass (p))
+            return cclass (p, x);
+        break;
+    case TOKEN_ANY:
+        op = lex->any (p) ? ANY : CHAR;
+        break;
+    case TOKEN_BOL:
+        op = lex->bol (p) ? BOL : CHAR;
+        break;
+    case TOKEN_EOL:
+        op = lex->eol (p) ? EOL : CHAR;
+        break;
+    case TOKEN_BOS:
+        op = lex->bos (p) ? BOS : CHAR;
+        break;
+    case TOKEN_EOS:
+        op = lex->eos (p) ? EOS : CHAR;
+        break;
+    case TOKEN_WORDB:
+        op = lex->wordb (p) ? WORDB : CHAR;
+        break;
+    case TOKEN_NWORDB:
+        op = lex->nwordb (p) ? NWORDB : CHAR;
+        break;
+    case TOKEN_BSNAME:
+        if (lex->bsname (p, name)) {
+            std::wstring s;
+            encode_posixname (name, s);
+            x = node (astnode::LEAF, instruction (CCLASS, s), -1);
+            return true;
+        }
+        break;
+    case TOKEN_BKREF:
+        if (lex->bkref (p, n)) {
+            x = node (astnode::LEAF, instruction (BKREF, n, 0, 0), -1);
+            return true;
+        }
+        break;
     }
+    if (CHAR != op)
+        x = node (astnode::LEAF, instruction (op), -1);
+    else if (lex->regchar (p, c))
+        x = node (astnode::LEAF, instruction (CHAR, std::wstring (1, c)), -1);
+    else
+        return false;
     return true;
 }
 
@@ -461,12 +692,14 @@ bool vmcompiler::factor (derivs_t& p, compenv& a, program& e)
 //    L2                     L2
 //
 // (?* e1 | e2 | e3) see gnest() member function
-bool vmcompiler::group (derivs_t& p, compenv& a, program& e)
+bool vmcompiler::group (derivs_t& p, int& x)
 {
-    if (lex->gcomment (p))
+    if (lex->gcomment (p)) {
+        x = node (astnode::CAT, instruction (MATCH), -1);
         return gcomment (p);
+    }
     else if (lex->gnest (p))
-        return gnest (p, a, e);
+        return gnest (p, x);
     operation op = lex->group (p) ? SAVE
                  : lex->lparen (p) ? MATCH
                  : lex->lkahead (p) ? LKAHEAD
@@ -476,29 +709,20 @@ bool vmcompiler::group (derivs_t& p, compenv& a, program& e)
                  : ANY;
     if (ANY == op)
         return false;
-    int n1 = (mgroup + 1) * 2, n2 = (mgroup + 1) * 2 + 1;
-    if (SAVE == op) {
-        ++mgroup;
-        if (a.behind)
-            std::swap (n1, n2);
-        e.push_back (instruction (SAVE, n1, 0, 0));
-    }
-    int const dot = e.size ();
-    if (LKAHEAD == op || NLKAHEAD == op || LKBEHIND == op || NLKBEHIND == op)
-        e.push_back (instruction (op, 0, 0, 0));
-    compenv a1 = a;
+    int const n = SAVE == op ? ++mgroup : 0;
+    bool const backward0 = backward;
     if (LKAHEAD == op || NLKAHEAD == op)
-        a1.behind = false;
+        backward = false;
     else if (LKBEHIND == op || NLKBEHIND == op)
-        a1.behind = true;
-    if (! (alt (p, a1, e) && lex->rparen (p)))
+        backward = true;
+    bool const ok = alt (p, x) && lex->rparen (p);
+    backward = backward0;
+    if (! ok)
         return false;
-    if (LKAHEAD == op || NLKAHEAD == op || LKBEHIND == op || NLKBEHIND == op) {
-        e.push_back (instruction (MATCH, 0, 0, 0));
-        e[dot].y = e.size () - dot - 1;
-    }
     if (SAVE == op)
-        e.push_back (instruction (SAVE, n2, 0, 0));
+        x = node (astnode::GROUP, instruction (SAVE, n * 2, n * 2 + 1, 0), x);
+    else if (MATCH != op)
+        x = node (astnode::LOOK, instruction (op, 0, 0, 0), x);
     return true;
 }
 
@@ -518,29 +742,18 @@ bool vmcompiler::group (derivs_t& p, compenv& a, program& e)
 //  L4  e1
 //      JMP     L1
 //  L5
-bool vmcompiler::gnest (derivs_t& p, compenv& a, program& e)
+bool vmcompiler::gnest (derivs_t& p, int& x)
 {
-    program lefttok, righttok, e1;
-    if (! (cat (p, a, lefttok) && lex->alt (p)))
+    std::vector<int> v (3);
+    if (! (cat (p, v[0]) && lex->alt (p)))
         return false;
-    if (! (cat (p, a, righttok) && lex->alt (p)))
+    if (! (cat (p, v[1]) && lex->alt (p)))
         return false;
-    if (! (alt (p, a, e1) && lex->rparen (p)))
+    if (! (alt (p, v[2]) && lex->rparen (p)))
         return false;
-    int const n1 = righttok.size ();
-    int const n2 = lefttok.size ();
-    int const n3 = e1.size ();
-    int const r = mreg++;
-    e.push_back (instruction (RESET, 0, 0, r));
-    e.push_back (instruction (JMP, n1 + 3, 0, 0));
-    e.push_back (instruction (SPLIT, 0, n1 + 1, 0));
-    e.insert (e.end (), righttok.begin (), righttok.end ());
-    e.push_back (instruction (DECJMP, -n1 - 2, n2 + n3 + 3, r));
-    e.push_back (instruction (SPLIT, 0, n2 + 1, 0));
-    e.insert (e.end (), lefttok.begin (), lefttok.end ());
-    e.push_back (instruction (INCJMP, -n1 - n2 - 4, -n1 - n2 - 4, r));
-    e.insert (e.end (), e1.begin (), e1.end ());
-    e.push_back (instruction (JMP, -n1 - n2 - n3 - 5, 0, 0));
+    for (int i = 1; i < 3; ++i)
+        ast[v[i - 1]].next = v[i];
+    x = node (astnode::NEST, instruction (RESET, 0, 0, mreg++), v[0]);
     return true;
 }
 
@@ -571,6 +784,150 @@ bool vmcompiler::gcomment (derivs_t& p)
     return true;
 }
 
+// the sizes of nodes in the order of the arena, children first.
+void vmcompiler::measure ()
+{
+    for (auto& t : ast) {
+        int n = 0;
+        int lhs = t.child < 0 ? 0 : ast[t.child].size;
+        switch (t.kind) {
+        case astnode::LEAF:
+            n = 1;
+            break;
+        case astnode::CAT:
+        case astnode::NEST:
+            for (int c = t.child; c >= 0; c = ast[c].next)
+                n += ast[c].size;
+            n += astnode::NEST == t.kind ? 7 : 0;
+            break;
+        case astnode::ALT:
+            for (int c = ast[t.child].next; c >= 0; c = ast[c].next) {
+                if (lhs == 0 && ast[c].size == 0)
+                    continue;
+                n += lhs + 2;
+                lhs = ast[c].size;
+            }
+            n += lhs;
+            break;
+        case astnode::REPEAT:
+            n = lhs + (t.op.x == 1 && t.op.y == -1 ? 1
+                     : t.op.x == 0 && t.op.y == 1 ? 1
+                     : t.op.x == 0 && t.op.y == -1 ? 2 : 4);
+            break;
+        case astnode::GROUP:
+            n = lhs + (saved[t.op.x / 2] ? 2 : 0);
+            break;
+        case astnode::LOOK:
+            n = lhs + 2;
+            break;
+        }
+        t.size = n;
+    }
+}
+
+// write the listings of the parsing member functions for the node n.
+// inside LOOKBEHIND, terms of cat go in the reverse order, and SAVE
+// swaps the start and the end of the group.
+void vmcompiler::emit (int n, compenv const& a, program& e)
+{
+    astnode const& t = ast[n];
+    switch (t.kind) {
+    case astnode::LEAF:
+        e.push_back (t.op);
+        break;
+    case astnode::CAT:
+        if (! a.behind)
+            for (int c = t.child; c >= 0; c = ast[c].next)
+                emit (c, a, e);
+        else {
+            std::vector<int> v;
+            for (int c = t.child; c >= 0; c = ast[c].next)
+                v.push_back (c);
+            for (auto i = v.rbegin (); i != v.rend (); ++i)
+                emit (*i, a, e);
+        }
+        break;
+    case astnode::ALT: {
+        std::vector<std::size_t> patch;
+        int lhs = t.child;
+        for (int c = ast[lhs].next; c >= 0; c = ast[c].next) {
+            if (ast[lhs].size == 0 && ast[c].size == 0)
+                continue;
+            e.push_back (instruction (SPLIT, 0, ast[lhs].size + 1, 0));
+            emit (lhs, a, e);
+            patch.push_back (e.size ());
+            e.push_back (instruction (JMP, 0, 0, 0));
+            lhs = c;
+        }
+        emit (lhs, a, e);
+        std::size_t const dot = e.size ();
+        for (auto i : patch)
+            e[i].x = dot - i - 1;
+        break;
+    }
+    case astnode::REPEAT: {
+        int const k1 = t.op.x, k2 = t.op.y;
+        int const n1 = ast[t.child].size;
+        int x = k1 == 1 && k2 == -1 ? -(n1 + 1) : 0;
+        int y = k1 == 0 && k2 == 1 ? n1 : k1 == 1 && k2 == -1 ? 0 : n1 + 1;
+        if (k1 != k2 && t.ngreedy)
+            std::swap (x, y);
+        if (k1 == 1 && k2 == -1) {
+            emit (t.child, a, e);
+            e.push_back (instruction (SPLIT, x, y, 0));
+            break;
+        }
+        int const z = k1 == 0 && k2 == -1 ? -(n1 + 2) : -(n1 + 3);
+        if (! (k1 == 0 && (k2 == 1 || k2 == -1))) {
+            e.push_back (instruction (RESET, 0, 0, t.op.r));
+            e.push_back (t.op);
+        }
+        e.push_back (instruction (SPLIT, x, y, 0));
+        emit (t.child, a, e);
+        if (! (k1 == 0 && k2 == 1))
+            e.push_back (instruction (JMP, z, 0, 0));
+        break;
+    }
+    case astnode::GROUP:
+        if (! saved[t.op.x / 2]) {
+            emit (t.child, a, e);
+            break;
+        }
+        e.push_back (instruction (SAVE, a.behind ? t.op.y : t.op.x, 0, 0));
+        emit (t.child, a, e);
+        e.push_back (instruction (SAVE, a.behind ? t.op.x : t.op.y, 0, 0));
+        break;
+    case astnode::LOOK: {
+        compenv a1 = a;
+        a1.behind = LKBEHIND == t.op.opcode || NLKBEHIND == t.op.opcode;
+        e.push_back (instruction (t.op.opcode, 0, ast[t.child].size + 1, 0));
+        emit (t.child, a1, e);
+        e.push_back (instruction (MATCH, 0, 0, 0));
+        break;
+    }
+    case astnode::NEST: {
+        int const lefttok = t.child;
+        int const righttok = ast[lefttok].next;
+        int const e1 = ast[righttok].next;
+        int const n1 = ast[righttok].size;
+        int const n2 = ast[lefttok].size;
+        int const n3 = ast[e1].size;
+        int const r = t.op.r;
+        e.push_back (instruction (RESET, 0, 0, r));
+        e.push_back (instruction (JMP, n1 + 3, 0, 0));
+        e.push_back (instruction (SPLIT, 0, n1 + 1, 0));
+        emit (righttok, a, e);
+        e.push_back (instruction (DECJMP, -n1 - 2, n2 + n3 + 3, r));
+        e.push_back (instruction (SPLIT, 0, n2 + 1, 0));
+        emit (lefttok, a, e);
+        e.push_back (instruction (INCJMP, -n1 - n2 - 4, -n1 - n2 - 4, r));
+        emit (e1, a, e);
+        e.push_back (instruction (JMP, -n1 - n2 - n3 - 5, 0, 0));
+        break;
+    }
+    }
+}
+
 // cclass <- '[' '^'? clschar ('-'? clschar)* '-'? ']'
 //
 // in the span string, charcters are quoted by a backslash.
@@ -589,7 +946,7 @@ bool vmcompiler::gcomment (derivs_t& p)
 //  S6 : rcclass S1 | range S7 | csetname S6 | clschar S4
 //  S7 : rcclass S1
 //
-bool vmcompiler::cclass (derivs_t& p, compenv& a, program& e)
+bool vmcompiler::cclass (derivs_t& p, int& x)
 {
     std::wstring s;
     operation op = CCLASS;
@@ -608,9 +965,9 @@ bool vmcompiler::cclass (derivs_t& p, compenv& a, program& e)
                 s.push_back (L'^');
                 next_state = 1;
             }
-            else if (csetname (p, a, s))
+            else if (csetname (p, s))
                 next_state = 6;
-            else if (clschar (p, a, s))
+            else if (clschar (p, s))
                 next_state = 4;
         }
         else if (lex->rcclass (p)) {
@@ -627,20 +984,20 @@ bool vmcompiler::cclass (derivs_t& p, compenv& a, program& e)
                 s.push_back (L'-');
             if (lex->range (p))
                 next_state = 4 == state ? 5 : 7;
-            else if (csetname (p, a, s))
+            else if (csetname (p, s))
                 next_state = 5 == state ? 0 : 6;
-            else if (clschar (p, a, s))
+            else if (clschar (p, s))
                 next_state = 4;
         }
     }
     if (! next_state)
         return false;
-    e.push_back (instruction (op, s));
+    x = node (astnode::LEAF, instruction (op, s), -1);
     return true;
 }
 
 // csetname <- '\\' [dswDWS] / posixname
-bool vmcompiler::csetname (derivs_t& p, compenv& a, std::wstring& s)
+bool vmcompiler::csetname (derivs_t& p, std::wstring& s)
 {
     std::wstring name;
     if (lex->posixname (p, name)) {
@@ -655,7 +1012,7 @@ bool vmcompiler::csetname (derivs_t& p, compenv& a, std::wstring& s)
 }
 
 // clschar <- regchar
-bool vmcompiler::clschar (derivs_t& p, compenv& a, std::wstring& s)
+bool vmcompiler::clschar (derivs_t& p, std::wstring& s)
 {
     wchar_t c;
     if (! lex->regchar (p, c))
@@ -695,28 +1052,73 @@ bool vmcompiler::encode_posixname (std::wstring name, std::wstring& s)
     return true;
 }
 
+// the needle when e has only CHAR instructions before MATCH.
+bool literal::compile (program const& e, int const flag)
+{
+    icase = (flag & t42::wregex::icase) != 0;
+    needle.clear ();
+    for (auto const& op : e)
+        if (CHAR == op.opcode)
+            needle.push_back (fold (op.s[0]));
+        else if (MATCH != op.opcode || &op != &e.back ()) {
+            needle.clear ();
+            return false;
+        }
+    std::size_t const n = needle.size ();
+    std::fill (shift, shift + 256, n);
+    for (std::size_t i = 0; i + 1 < n; ++i)
+        shift[needle[i] & 0xff] = n - 1 - i;
+    return n > 0;
+}
+
 }//namespace wpike
 
 wregex::wregex (std::wstring s)
 {
-    auto lex = std::make_shared<wpike::vmlex> ();
-    wpike::vmcompiler comp (lex);
-    flag = 0;
-    s.push_back (L'\0');
-    std::wstring::iterator p = s.begin ();
-    if (! comp.exp (p, e))
-        throw regex_error ();
+    compile (std::move (s), 0, nullptr);
 }
 
 wregex::wregex (std::wstring s, flag_type f)
+{
+    compile (std::move (s), f, nullptr);
+}
+
+// only the groups in the list and those of backreferences are captured.
+wregex::wregex (std::wstring s, flag_type f, std::vector<int> const& groups)
+{
+    compile (std::move (s), f, &groups);
+}
+
+// groups is nullptr to capture all of them. the literal and the
+// bit-parallel automaton serve the patterns fit them.
+void wregex::compile (std::wstring s, flag_type const f, std::vector<int> const* groups)
 {
     auto lex = std::make_shared<wpike::vmlex> ();
     wpike::vmcompiler comp (lex);
     flag = f;
+    if (flag & nosubs)
+        comp.keep (std::vector<int> ());
+    else if (groups)
+        comp.keep (*groups);
     s.push_back (L'\0');
     std::wstring::iterator p = s.begin ();
     if (! comp.exp (p, e))
         throw regex_error ();
+    comp.reverse (sfx);
+    if (lit.compile (e, flag))
+        return;
+    if (wpike::glushkov::fits (e))
+        bits = std::make_shared<wpike::glushkov_once> ();
 }
 
+// the pattern in UTF-8, UTF-16, or UTF-32 is decoded to compile.
+wregex::wregex (std::string const& s, flag_type f)
+    : wregex (wpike::widen (s), f) {}
+
+wregex::wregex (std::u16string const& s, flag_type f)
+    : wregex (wpike::widen (s), f) {}
+
+wregex::wregex (std::u32string const& s, flag_type f)
+    : wregex (wpike::widen (s), f) {}
+
 }//namespace t42
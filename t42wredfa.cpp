@@ -0,0 +1,612 @@
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <sstream>
+#include <cwctype>
+#include "t42wregex.hpp"
+
+namespace t42 {
+namespace wpike {
+
+int iswword (std::wint_t c);
+
+// a predicate distinguishes characters, and a class is a set of characters
+// with the same results of all predicates.
+struct charpred {
+    operation opcode;   // CHAR, CCLASS, or EOL for the line feed, WORDB for \w
+    std::wstring s;
+
+    bool operator< (charpred const& x) const
+    {
+        return opcode != x.opcode ? opcode < x.opcode : s < x.s;
+    }
+
+    bool operator() (wchar_t const c, int const flag) const
+    {
+        switch (opcode) {
+        case CHAR:
+            return wchar_equal (c, s[0], flag);
+        case CCLASS:
+            return cclass (s, c, flag);
+        case EOL:
+            return L'\n' == c;
+        default:
+            return iswword (c) != 0;
+        }
+    }
+};
+
+// the classes are found from the boundaries of the literal characters
+// and ranges in the program. with icase or posix names, the boundaries
+// are unknown, so that all code points are looked at.
+alphabet::alphabet (program const& e, int const flag)
+{
+    enum { LIMIT = 0x110000 };
+    std::vector<charpred> pred{charpred{EOL, L""}};
+    bool full = (flag & t42::wregex::icase) != 0;
+    for (auto const& op : e)
+        switch (op.opcode) {
+        case CHAR:
+            pred.push_back (charpred{CHAR, op.s});
+            break;
+        case CCLASS:
+        case NCCLASS:
+            pred.push_back (charpred{CCLASS, op.s});
+            full = full || op.s.find (L':') != std::wstring::npos;
+            break;
+        case WORDB:
+        case NWORDB:
+            pred.push_back (charpred{WORDB, L""});
+            full = true;
+            break;
+        default:
+            break;
+        }
+    std::sort (pred.begin (), pred.end ());
+    pred.erase (std::unique (pred.begin (), pred.end (), [] (charpred const& a, charpred const& b) {
+        return ! (a < b) && ! (b < a);
+    }), pred.end ());
+    // the starts of segments where results of predicates are constant.
+    std::vector<unsigned long> cut{0, 256, LIMIT};
+    if (full)
+        for (unsigned long c = 0; c < LIMIT; ++c)
+            cut.push_back (c);
+    else {
+        cut.push_back (L'\n');
+        cut.push_back (L'\n' + 1);
+        for (auto const& x : pred)
+            for (std::size_t i = 0; i < x.s.size (); ++i)
+                if (CHAR == x.opcode || (L'\\' == x.s[i] && ++i < x.s.size ())) {
+                    cut.push_back (static_cast<unsigned long> (x.s[i]));
+                    cut.push_back (static_cast<unsigned long> (x.s[i]) + 1);
+                }
+    }
+    std::sort (cut.begin (), cut.end ());
+    cut.erase (std::unique (cut.begin (), cut.end ()), cut.end ());
+    std::map<std::vector<bool>, int> sig;
+    std::vector<bool> v (pred.size ()), prev;
+    nclass = 0;
+    int k = 0;
+    for (std::size_t i = 0; i < cut.size (); ++i) {
+        wchar_t const c = static_cast<wchar_t> (cut[i]);
+        for (std::size_t j = 0; j < pred.size (); ++j)
+            v[j] = pred[j] (c, flag);
+        if (i == 0 || v != prev) {
+            auto const r = sig.insert (std::make_pair (v, nclass));
+            if (r.second) {
+                rep.push_back (c);
+                ++nclass;
+            }
+            k = r.first->second;
+            prev = v;
+        }
+        unsigned long const next = i + 1 < cut.size () ? cut[i + 1] : cut[i] + 1;
+        if (cut[i] < 256)
+            for (unsigned long u = cut[i]; u < next; ++u)
+                low[u] = k;
+        else if (cls.empty () || cls.back () != k) {
+            from.push_back (cut[i]);
+            cls.push_back (k);
+        }
+    }
+}
+
+// a thread of the subset construction with its counters of REP.
+struct dfathread {
+    int ip;
+    std::vector<int> cnt;
+};
+
+// threads are marked by their instruction pointers and the counters
+// of their regions, as epsilon_closure::markindex () does.
+class dfamark {
+public:
+    explicit dfamark (program const& e) : base (e.size () + 1, 0)
+    {
+        markregions (e, nestreg);
+        for (std::size_t ip = 0; ip < e.size (); ++ip) {
+            std::size_t w = 1;
+            for (auto const& r : nestreg[ip])
+                w *= r.second;
+            base[ip + 1] = base[ip] + w;
+        }
+        mark.assign (base.back (), 0);
+    }
+
+    int& operator[] (dfathread const& th)
+    {
+        std::size_t k = base[th.ip];
+        std::size_t w = 1;
+        for (auto const& r : nestreg[th.ip]) {
+            k += w * std::max (0, std::min (th.cnt[r.first], r.second - 1));
+            w *= r.second;
+        }
+        return mark[k];
+    }
+private:
+    std::vector<std::vector<std::pair<int, int>>> nestreg;
+    std::vector<std::size_t> base;
+    std::vector<int> mark;
+};
+
+// the epsilon closure as epsilon_closure::addthread () does.
+// the counter of an unbounded REP saturates at its minimum plus 1,
+// so that the number of states is finite.
+static void dfaclosure (program const& e, dfamark& mark, int const gen,
+    std::vector<dfathread>& q, dfathread&& th)
+{
+    if (mark[th] == gen)
+        return;
+    mark[th] = gen;
+    instruction const& op = e[th.ip];
+    switch (op.opcode) {
+    default:
+        q.push_back (std::move (th));
+        break;
+    case SAVE:
+        dfaclosure (e, mark, gen, q, dfathread{th.ip + 1, th.cnt});
+        break;
+    case JMP:
+        dfaclosure (e, mark, gen, q, dfathread{th.ip + 1 + op.x, th.cnt});
+        break;
+    case SPLIT:
+        dfaclosure (e, mark, gen, q, dfathread{th.ip + 1 + op.x, th.cnt});
+        dfaclosure (e, mark, gen, q, dfathread{th.ip + 1 + op.y, th.cnt});
+        break;
+    case RESET:
+        th.cnt[op.r] = 0;
+        dfaclosure (e, mark, gen, q, dfathread{th.ip + 1, th.cnt});
+        break;
+    case REP:
+        {
+            int const i = th.cnt[op.r] + 1;
+            th.cnt[op.r] = op.y == -1 ? std::min (i, op.x + 1) : i;
+            if (i <= op.x)
+                dfaclosure (e, mark, gen, q, dfathread{th.ip + 2, th.cnt});
+            else if (op.y == -1 || i <= op.y)
+                dfaclosure (e, mark, gen, q, dfathread{th.ip + 1, th.cnt});
+            else {
+                int const out = std::max (e[th.ip + 1].x, e[th.ip + 1].y);
+                dfaclosure (e, mark, gen, q, dfathread{th.ip + 2 + out, th.cnt});
+            }
+        }
+        break;
+    }
+}
+
+dfa::dfa (program const& e0, int const f)
+    : e (e0), flag (f), abc (e0, f), start (DEAD) {}
+
+// the subset construction. returns false when the program has
+// unsupported instructions, or the states exceed maxstate.
+bool dfa::build (std::size_t const maxstate)
+{
+    int nreg = 0;
+    for (auto const& op : e)
+        switch (op.opcode) {
+        case MATCH: case CHAR: case ANY: case CCLASS: case NCCLASS:
+        case SAVE: case JMP: case SPLIT:
+            break;
+        case RESET:
+        case REP:
+            nreg = std::max (nreg, op.r + 1);
+            break;
+        default:
+            return false;
+        }
+    int const m = abc.size ();
+    dfamark mark (e);
+    int gen = 0;
+    std::vector<std::vector<dfathread>> state (1);
+    std::map<std::vector<int>, int> id;
+    next.clear ();
+    accept.clear ();
+    // the list is cut off after MATCH, and it is keyed by the threads.
+    auto intern = [&] (std::vector<dfathread>& q) -> int {
+        std::vector<int> key;
+        for (std::size_t i = 0; i < q.size (); ++i) {
+            key.push_back (q[i].ip);
+            key.insert (key.end (), q[i].cnt.begin (), q[i].cnt.end ());
+            if (MATCH == e[q[i].ip].opcode) {
+                q.resize (i + 1);
+                break;
+            }
+        }
+        if (q.empty ())
+            return DEAD;
+        auto const r = id.insert (std::make_pair (key, static_cast<int> (state.size ())));
+        if (r.second)
+            state.push_back (std::move (q));
+        return r.first->second;
+    };
+    std::vector<dfathread> q;
+    dfaclosure (e, mark, ++gen, q, dfathread{0, std::vector<int> (nreg, 0)});
+    start = intern (q);
+    for (std::size_t s = 0; s < state.size (); ++s) {
+        if (state.size () > maxstate)
+            return false;
+        accept.push_back (! state[s].empty () && MATCH == e[state[s].back ().ip].opcode);
+        for (int k = 0; k < m; ++k) {
+            wchar_t const c = abc.representative (k);
+            q.clear ();
+            ++gen;
+            for (dfathread const& th : state[s]) {
+                instruction const& op = e[th.ip];
+                bool const ok = CHAR == op.opcode ? wchar_equal (c, op.s[0], flag)
+                              : ANY == op.opcode ? true
+                              : CCLASS == op.opcode || NCCLASS == op.opcode
+                                ? cclass (op.s, c, flag) ^ (NCCLASS == op.opcode)
+                              : false;
+                if (ok)
+                    dfaclosure (e, mark, gen, q, dfathread{th.ip + 1, th.cnt});
+            }
+            next.push_back (intern (q));
+        }
+    }
+    return true;
+}
+
+// Hopcroft's partition refinement from accepting and the other states.
+// the dead state is merged with the states never reaching MATCH.
+// the members of a block are the range [first, end) of elem, where loc is
+// the index of a state. the touched states are swapped to the front of
+// their block up to mid, so that a split costs the number of them.
+void dfa::minimize ()
+{
+    int const n = size ();
+    int const m = abc.size ();
+    if (n == 0)
+        return;
+    std::vector<std::vector<int>> inv (static_cast<std::size_t> (n) * m);
+    for (int s = 0; s < n; ++s)
+        for (int k = 0; k < m; ++k)
+            inv[static_cast<std::size_t> (next[s * m + k]) * m + k].push_back (s);
+    std::vector<int> elem, loc (n), block (n);
+    std::vector<int> first (2), mid, end (2);
+    for (int b = 0; b < 2; ++b) {
+        first[b] = elem.size ();
+        for (int s = 0; s < n; ++s)
+            if ((accept[s] ? 1 : 0) == b) {
+                block[s] = b;
+                loc[s] = elem.size ();
+                elem.push_back (s);
+            }
+        end[b] = elem.size ();
+    }
+    mid = first;
+    std::vector<int> work;
+    std::vector<char> inwork (2, 0);
+    for (int b = 0; b < 2; ++b)
+        if (first[b] < end[b]) {
+            work.push_back (b);
+            inwork[b] = 1;
+        }
+    std::vector<int> splitter, touched;
+    while (! work.empty ()) {
+        int const a = work.back ();
+        work.pop_back ();
+        inwork[a] = 0;
+        splitter.assign (elem.begin () + first[a], elem.begin () + end[a]);
+        for (int k = 0; k < m; ++k) {
+            touched.clear ();
+            for (int t : splitter)
+                for (int s : inv[static_cast<std::size_t> (t) * m + k]) {
+                    int const b = block[s];
+                    if (mid[b] == first[b])
+                        touched.push_back (b);
+                    int const u = elem[mid[b]];
+                    std::swap (elem[loc[s]], elem[mid[b]]);
+                    loc[u] = loc[s];
+                    loc[s] = mid[b]++;
+                }
+            for (int b : touched) {
+                if (mid[b] == end[b]) {
+                    mid[b] = first[b];
+                    continue;
+                }
+                int const nb = first.size ();
+                first.push_back (first[b]);
+                end.push_back (mid[b]);
+                mid.push_back (first[b]);
+                first[b] = mid[b];
+                for (int i = first[nb]; i < end[nb]; ++i)
+                    block[elem[i]] = nb;
+                inwork.push_back (0);
+                if (inwork[b] || end[nb] - first[nb] <= end[b] - first[b]) {
+                    work.push_back (nb);
+                    inwork[nb] = 1;
+                }
+                else {
+                    work.push_back (b);
+                    inwork[b] = 1;
+                }
+            }
+        }
+    }
+    // renumber the blocks, the block of the dead state is the new dead state.
+    std::vector<int> renum (first.size (), -1);
+    std::vector<int> member;
+    renum[block[DEAD]] = DEAD;
+    member.push_back (DEAD);
+    for (int s = 0; s < n; ++s)
+        if (renum[block[s]] < 0) {
+            renum[block[s]] = member.size ();
+            member.push_back (s);
+        }
+    std::vector<int> next1 (member.size () * m);
+    std::vector<char> accept1 (member.size ());
+    for (std::size_t i = 0; i < member.size (); ++i) {
+        accept1[i] = accept[member[i]];
+        for (int k = 0; k < m; ++k)
+            next1[i * m + k] = renum[block[next[member[i] * m + k]]];
+    }
+    start = renum[block[start]];
+    next.swap (next1);
+    accept.swap (accept1);
+}
+
+std::wstring::size_type dfa::exec (std::wstring const& s, std::wstring::size_type const sp) const
+{
+    int const m = abc.size ();
+    int st = start;
+    std::wstring::size_type end = accept[st] ? sp : std::wstring::npos;
+    for (std::wstring::size_type i = sp; st != DEAD && i < s.size (); ++i) {
+        st = next[st * m + abc.classof (s[i])];
+        if (accept[st])
+            end = i + 1;
+    }
+    return end;
+}
+
+static bool consumes (instruction const& op, wchar_t const c, int const flag)
+{
+    return CHAR == op.opcode ? wchar_equal (c, op.s[0], flag)
+         : ANY == op.opcode ? true
+         : cclass (op.s, c, flag) ^ (NCCLASS == op.opcode);
+}
+
+// the positions and whether MATCH is reachable from ip by epsilons.
+static void glushkov_closure (program const& e, std::vector<int> const& posof,
+    std::vector<char>& seen, int const ip, std::uint64_t& m, bool& accept)
+{
+    if (seen[ip])
+        return;
+    seen[ip] = 1;
+    instruction const& op = e[ip];
+    switch (op.opcode) {
+    case MATCH:
+        accept = true;
+        break;
+    case SAVE:
+        glushkov_closure (e, posof, seen, ip + 1, m, accept);
+        break;
+    case JMP:
+        glushkov_closure (e, posof, seen, ip + 1 + op.x, m, accept);
+        break;
+    case SPLIT:
+        glushkov_closure (e, posof, seen, ip + 1 + op.x, m, accept);
+        glushkov_closure (e, posof, seen, ip + 1 + op.y, m, accept);
+        break;
+    default:
+        m |= std::uint64_t (1) << posof[ip];
+        break;
+    }
+}
+
+// whether e has only the instructions and the positions it supports.
+bool glushkov::fits (program const& e)
+{
+    int n = 0;
+    for (auto const& op : e)
+        switch (op.opcode) {
+        case CHAR: case ANY: case CCLASS: case NCCLASS:
+            if (++n > MAXPOS)
+                return false;
+            break;
+        case MATCH: case SAVE: case JMP: case SPLIT:
+            break;
+        default:
+            return false;
+        }
+    return true;
+}
+
+bool glushkov::build (program const& e, int const f)
+{
+    if (! fits (e))
+        return false;
+    std::vector<int> posof (e.size (), -1);
+    flag = f;
+    capturing = false;
+    pos.clear ();
+    for (std::size_t ip = 0; ip < e.size (); ++ip)
+        if (SAVE == e[ip].opcode)
+            capturing = true;
+        else if (CHAR == e[ip].opcode || ANY == e[ip].opcode
+                || CCLASS == e[ip].opcode || NCCLASS == e[ip].opcode) {
+            posof[ip] = pos.size ();
+            pos.push_back (e[ip]);
+        }
+    std::vector<char> seen (e.size ());
+    std::vector<std::uint64_t> next (MAXPOS, 0);
+    first = last = 0;
+    nullable = false;
+    glushkov_closure (e, posof, seen, 0, first, nullable);
+    for (std::size_t ip = 0; ip < e.size (); ++ip) {
+        if (posof[ip] < 0)
+            continue;
+        bool accept = false;
+        std::fill (seen.begin (), seen.end (), 0);
+        glushkov_closure (e, posof, seen, ip + 1, next[posof[ip]], accept);
+        if (accept)
+            last |= std::uint64_t (1) << posof[ip];
+    }
+    std::vector<std::uint64_t> prev (MAXPOS, 0);
+    for (std::size_t i = 0; i < pos.size (); ++i)
+        for (std::size_t j = 0; j < pos.size (); ++j)
+            if (next[i] >> j & 1)
+                prev[j] |= std::uint64_t (1) << i;
+    int const nbyte = (pos.size () + 7) / 8;
+    for (int k = 0; k < 8; ++k) {
+        follow[k][0] = precede[k][0] = 0;
+        for (int b = 1; b < 256; ++b) {
+            int j = 0;
+            if (k >= nbyte) {
+                follow[k][b] = precede[k][b] = 0;
+                continue;
+            }
+            while (! (b >> j & 1))
+                ++j;
+            follow[k][b] = follow[k][b & (b - 1)] | next[k * 8 + j];
+            precede[k][b] = precede[k][b & (b - 1)] | prev[k * 8 + j];
+        }
+    }
+    // characters of CHAR set their bits at once, unless with icase.
+    std::fill (low, low + 256, 0);
+    bool const icase = (flag & t42::wregex::icase) != 0;
+    for (std::size_t i = 0; i < pos.size (); ++i) {
+        std::uint64_t const bit = std::uint64_t (1) << i;
+        unsigned long const u = static_cast<unsigned long> (pos[i].s.empty () ? 0 : pos[i].s[0]);
+        if (CHAR == pos[i].opcode && ! icase) {
+            if (u < 256)
+                low[u] |= bit;
+        }
+        else
+            for (int c = 0; c < 256; ++c)
+                if (consumes (pos[i], static_cast<wchar_t> (c), flag))
+                    low[c] |= bit;
+    }
+    return true;
+}
+
+// the positions accepting c.
+std::uint64_t glushkov::accepts (wchar_t const c) const
+{
+    std::uint64_t m = 0;
+    for (std::size_t i = 0; i < pos.size (); ++i)
+        if (consumes (pos[i], c, flag))
+            m |= std::uint64_t (1) << i;
+    return m;
+}
+
+std::wstring::size_type glushkov::exec (std::wstring const& s, std::wstring::size_type const sp,
+    bool const longest) const
+{
+    std::wstring::size_type end = nullable ? sp : std::wstring::npos;
+    if (nullable && ! longest)
+        return end;
+    std::uint64_t f = first;
+    for (std::wstring::size_type i = sp; i < s.size (); ++i) {
+        std::uint64_t const d = f & mask (s[i]);
+        if (! d)
+            break;
+        if (d & last) {
+            end = i + 1;
+            if (! longest)
+                break;
+        }
+        f = step (d);
+    }
+    return end;
+}
+
+bool glushkov::matches (std::wstring const& s) const
+{
+    std::uint64_t f = first;
+    std::uint64_t d = 0;
+    for (std::wstring::size_type i = 0; i < s.size (); ++i) {
+        d = f & mask (s[i]);
+        if (! d)
+            return false;
+        f = step (d);
+    }
+    return s.empty () ? nullable : (d & last) != 0;
+}
+
+// the bit i of at for each position i from sp where a match starts.
+// the reversed automaton scans s back, where a match may end anywhere,
+// so that the last positions join the live ones at each step.
+// an empty match is not seen.
+void glushkov::starts (std::wstring const& s, std::wstring::size_type const sp,
+    std::vector<std::uint64_t>& at) const
+{
+    at.assign (s.size () / 64 + 1, 0);
+    std::uint64_t f = 0;
+    for (std::wstring::size_type i = s.size (); i > sp; ) {
+        --i;
+        std::uint64_t const d = (f | last) & mask (s[i]);
+        if (d & first)
+            at[i / 64] |= std::uint64_t (1) << (i % 64);
+        f = stepback (d);
+    }
+}
+
+template<typename T>
+static void emit_table (std::ostringstream& out, char const* type, std::string const& name,
+    std::vector<T> const& v)
+{
+    out << "static " << type << " const " << name << "[" << v.size () << "] = {";
+    for (std::size_t i = 0; i < v.size (); ++i)
+        out << (i % 16 ? " " : "\n    ") << static_cast<unsigned long> (v[i]) << ",";
+    out << "\n};\n\n";
+}
+
+// the C++ source of the function
+//      std::wstring::size_type name (std::wstring const& s, std::wstring::size_type sp)
+// which does the same as exec with the tables of the alphabet and transitions.
+std::string dfa::emit_cpp (std::string const& name) const
+{
+    std::size_t const n = size ();
+    char const* const statetype = n <= 256 ? "unsigned char"
+                                : n <= 65536 ? "unsigned short" : "unsigned int";
+    std::ostringstream out;
+    out << "// generated by t42::wpike::dfa::emit_cpp, "
+        << n << " states, " << abc.size () << " classes.\n"
+        << "#include <string>\n#include <algorithm>\n\n";
+    emit_table (out, "unsigned int", name + "_low", std::vector<int> (abc.low, abc.low + 256));
+    emit_table (out, "unsigned long", name + "_from", abc.from);
+    emit_table (out, "unsigned int", name + "_cls", abc.cls);
+    emit_table (out, statetype, name + "_next", next);
+    emit_table (out, "bool", name + "_accept", accept);
+    out << "std::wstring::size_type " << name
+        << " (std::wstring const& s, std::wstring::size_type const sp)\n"
+        << "{\n"
+        << "    unsigned int st = " << start << ";\n"
+        << "    std::wstring::size_type end = " << name << "_accept[st] ? sp : std::wstring::npos;\n"
+        << "    for (std::wstring::size_type i = sp; st != 0 && i < s.size (); ++i) {\n"
+        << "        unsigned long const u = static_cast<unsigned long> (s[i]);\n"
+        << "        unsigned int const k = u < 256 ? " << name << "_low[u]\n"
+        << "            : " << name << "_cls[std::upper_bound (" << name << "_from, "
+        << name << "_from + " << abc.from.size () << ", u) - " << name << "_from - 1];\n"
+        << "        st = " << name << "_next[st * " << abc.size () << " + k];\n"
+        << "        if (" << name << "_accept[st])\n"
+        << "            end = i + 1;\n"
+        << "    }\n"
+        << "    return end;\n"
+        << "}\n";
+    return out.str ();
+}
+
+}//namespace wpike
+}//namespace t42
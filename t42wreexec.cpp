@@ -1,59 +1,185 @@
 #include <vector>
+#include <deque>
 #include <string>
+#include <algorithm>
 #include <memory>
 #include <utility>
 #include <cwctype>
+#include <cwchar>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <chrono>
+#include <limits>
+#include <cstdint>
+#if defined (__AVX2__)
+#include <immintrin.h>
+#elif defined (__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "t42wregex.hpp"
 #include <iostream>
 
 namespace t42 {
 namespace wpike {
 
-static bool table_c7toi_ready = false;
-static int table_c7toi[256];
-
+// the table is a function-local static, so that its initialisation
+// is thread-safe for the workers of exec_batch.
 int c7toi (wchar_t const c)
 {
-    static wchar_t const* digit = L"0123456789";
-    static wchar_t const* upper = L"ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-    static wchar_t const* lower = L"abcdefghijklmnopqrstuvwxyz";
-    int i;
-    if (c <= 0 || c > 256)
-        return 36;
-    if (! table_c7toi_ready) {
-        table_c7toi_ready = true;
-        for (i = 0; i < 256; ++i)
-            table_c7toi[i] = 36;
-        for (i = 0; i < 10; ++i)
-            table_c7toi[digit[i]] = i;
-        for (i = 0; i < 26; ++i) {
-            table_c7toi[upper[i]] = i + 10;
-            table_c7toi[lower[i]] = i + 10;
+    struct table {
+        int v[256];
+        table ()
+        {
+            static wchar_t const* digit = L"0123456789";
+            static wchar_t const* upper = L"ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+            static wchar_t const* lower = L"abcdefghijklmnopqrstuvwxyz";
+            int i;
+            for (i = 0; i < 256; ++i)
+                v[i] = 36;
+            for (i = 0; i < 10; ++i)
+                v[digit[i]] = i;
+            for (i = 0; i < 26; ++i) {
+                v[upper[i]] = i + 10;
+                v[lower[i]] = i + 10;
+            }
         }
-    }
-    return table_c7toi[c];
+    };
+    static table const table_c7toi;
+    if (c <= 0 || c >= 256)
+        return 36;
+    return table_c7toi.v[c];
 }
 
 typedef std::size_t instruction_pointer;
 typedef std::wstring::size_type string_pointer;
-typedef std::shared_ptr<capture_list> capture_ptr;
+typedef std::size_t capture_ref;
 typedef std::vector<int> counter_list;
 typedef std::shared_ptr<counter_list> counter_ptr;
 
-struct vmthread {
-    instruction_pointer ip;
-    capture_ptr cap;
-    counter_ptr cnt;
+// the captures of threads are an append-only log of their SAVEs.
+// an entry has the slot and the position linked to the previous entry
+// of the thread, so that a thread holds the index of its last entry,
+// and a forked thread shares it. the capture list is rebuilt by walking
+// back from the thread that matches. npos is the ref of no captures.
+//
+// a chain deeper than maxdepth () is collapsed to the latest entry of
+// each slot, and compact () drops the entries no live thread reaches.
+class capture_log {
+public:
+    capture_log () : live (0), nslot (2) {}
 
-    capture_ptr update (std::size_t const i, string_pointer const x) const
+    capture_ref start (string_pointer const sp)
     {
-        capture_ptr u = std::make_shared<capture_list> (cap->begin (), cap->end ());
-        if (u->size () < i + 1)
-            u->resize (i + 1, std::wstring::npos);
-        (*u)[i] = x;
-        return u;
+        return push (1, sp, push (0, sp, std::wstring::npos));
     }
 
+    capture_ref save (capture_ref const x, std::size_t const i, string_pointer const sp)
+    {
+        if (x == std::wstring::npos)
+            return x;
+        if (log[x].depth < maxdepth ())
+            return push (i, sp, x);
+        return collapse (x, i, sp);
+    }
+
+    string_pointer get (capture_ref x, std::size_t const i) const
+    {
+        for (; x != std::wstring::npos; x = log[x].parent)
+            if (log[x].slot == i)
+                return log[x].pos;
+        return std::wstring::npos;
+    }
+
+    void get (capture_ref x, capture_list& m) const;
+    bool due () const { return log.size () >= std::max<std::size_t> (MINLOG, live * 2); }
+    void compact (std::vector<capture_ref*> const& roots);
+private:
+    enum { MINLOG = 4096, MINDEPTH = 64 };
+    struct entry {
+        std::uint32_t slot;
+        std::uint32_t depth;
+        string_pointer pos;
+        capture_ref parent;
+    };
+    std::vector<entry> log;
+    std::vector<capture_ref> remap;
+    capture_list scratch;
+    std::size_t live;
+    std::size_t nslot;
+
+    std::size_t maxdepth () const { return std::max<std::size_t> (MINDEPTH, nslot * 4); }
+
+    capture_ref push (std::size_t const i, string_pointer const sp, capture_ref const x)
+    {
+        nslot = std::max (nslot, i + 1);
+        std::uint32_t const depth = x == std::wstring::npos ? 1 : log[x].depth + 1;
+        log.push_back (entry{static_cast<std::uint32_t> (i), depth, sp, x});
+        return log.size () - 1;
+    }
+
+    capture_ref collapse (capture_ref const x, std::size_t const i, string_pointer const sp);
+};
+
+// the latest position of each slot, npos for the slots not saved.
+void capture_log::get (capture_ref x, capture_list& m) const
+{
+    m.clear ();
+    for (; x != std::wstring::npos; x = log[x].parent) {
+        entry const& t = log[x];
+        if (m.size () <= t.slot)
+            m.resize (t.slot + 1, std::wstring::npos);
+        if (m[t.slot] == std::wstring::npos)
+            m[t.slot] = t.pos;
+    }
+}
+
+capture_ref capture_log::collapse (capture_ref const x, std::size_t const i, string_pointer const sp)
+{
+    get (x, scratch);
+    if (scratch.size () <= i)
+        scratch.resize (i + 1, std::wstring::npos);
+    scratch[i] = sp;
+    capture_ref y = std::wstring::npos;
+    for (std::size_t k = 0; k < scratch.size (); ++k)
+        if (scratch[k] != std::wstring::npos)
+            y = push (k, scratch[k], y);
+    return y;
+}
+
+// parents precede their children, so that the kept entries slide down
+// in place with their parents renumbered before them.
+void capture_log::compact (std::vector<capture_ref*> const& roots)
+{
+    enum { KEEP = 0 };
+    remap.assign (log.size (), std::wstring::npos);
+    for (capture_ref const* r : roots)
+        for (capture_ref x = *r; x != std::wstring::npos && remap[x] == std::wstring::npos; x = log[x].parent)
+            remap[x] = KEEP;
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < log.size (); ++i)
+        if (remap[i] != std::wstring::npos) {
+            entry t = log[i];
+            if (t.parent != std::wstring::npos)
+                t.parent = remap[t.parent];
+            log[n] = t;
+            remap[i] = n++;
+        }
+    log.resize (n);
+    live = n;
+    for (capture_ref* r : roots)
+        if (*r != std::wstring::npos)
+            *r = remap[*r];
+}
+
+// wait and ahead are for a thread on BKREF, see epsilon_closure::backref ().
+struct vmthread {
+    instruction_pointer ip;
+    capture_ref cap;
+    counter_ptr cnt;
+    std::size_t wait;
+    std::size_t ahead;
+
     counter_ptr preset (std::size_t const i, int const x) const
     {
         counter_ptr u = std::make_shared<counter_list> (cnt->begin (), cnt->end ());
@@ -66,125 +192,672 @@ struct vmthread {
 
 typedef std::vector<vmthread> vmthread_que;
 
-class epsilon_closure {
+// the vm decodes the code units of the subject into characters on the fly.
+// positions are the offsets of code units, and a step consumes a character
+// of one or more units.
+//
+//  wchar_t, char32_t   a unit is a character
+//  char16_t            UTF-16
+//  char                UTF-8
+//
+// decode () reads the character from p[0], decodeback () reads the one
+// ending at p[-1], where n > 0 units are available in the direction.
+// an ill-formed unit decodes to U+FFFD of width 1.
+template<typename charT>
+struct codec {
+    static wchar_t decode (charT const* p, std::size_t, std::size_t& width)
+    {
+        width = 1;
+        return static_cast<wchar_t> (*p);
+    }
+
+    static wchar_t decodeback (charT const* p, std::size_t, std::size_t& width)
+    {
+        width = 1;
+        return static_cast<wchar_t> (p[-1]);
+    }
+
+    static std::size_t encode (wchar_t const c, charT* p)
+    {
+        *p = static_cast<charT> (c);
+        return 1;
+    }
+};
+
+enum { REPLACEMENT_CHARACTER = 0xfffd };
+
+template<>
+struct codec<char16_t> {
+    static bool ishigh (char16_t const c) { return 0xd800 <= c && c <= 0xdbff; }
+    static bool islow (char16_t const c) { return 0xdc00 <= c && c <= 0xdfff; }
+
+    static wchar_t pair (char16_t const c0, char16_t const c1)
+    {
+        return static_cast<wchar_t> (0x10000 + ((c0 - 0xd800) << 10) + (c1 - 0xdc00));
+    }
+
+    static wchar_t decode (char16_t const* p, std::size_t const n, std::size_t& width)
+    {
+        width = 1;
+        if (n > 1 && ishigh (p[0]) && islow (p[1])) {
+            width = 2;
+            return pair (p[0], p[1]);
+        }
+        return ishigh (p[0]) || islow (p[0]) ? REPLACEMENT_CHARACTER : p[0];
+    }
+
+    static wchar_t decodeback (char16_t const* p, std::size_t const n, std::size_t& width)
+    {
+        width = 1;
+        if (n > 1 && islow (p[-1]) && ishigh (p[-2])) {
+            width = 2;
+            return pair (p[-2], p[-1]);
+        }
+        return ishigh (p[-1]) || islow (p[-1]) ? REPLACEMENT_CHARACTER : p[-1];
+    }
+
+    static std::size_t encode (wchar_t const c, char16_t* p)
+    {
+        if (c < 0x10000) {
+            p[0] = static_cast<char16_t> (c);
+            return 1;
+        }
+        p[0] = static_cast<char16_t> (0xd800 + ((c - 0x10000) >> 10));
+        p[1] = static_cast<char16_t> (0xdc00 + ((c - 0x10000) & 0x3ff));
+        return 2;
+    }
+};
+
+template<>
+struct codec<char> {
+    static wchar_t decode (char const* p, std::size_t const n, std::size_t& width)
+    {
+        unsigned char const c0 = p[0];
+        width = 1;
+        if (c0 < 0x80)
+            return c0;
+        std::size_t w;
+        unsigned long c, lo;
+        if (0xc2 <= c0 && c0 <= 0xdf)
+            w = 2, c = c0 & 0x1f, lo = 0x80;
+        else if (0xe0 <= c0 && c0 <= 0xef)
+            w = 3, c = c0 & 0x0f, lo = 0x800;
+        else if (0xf0 <= c0 && c0 <= 0xf4)
+            w = 4, c = c0 & 0x07, lo = 0x10000;
+        else
+            return REPLACEMENT_CHARACTER;
+        if (n < w)
+            return REPLACEMENT_CHARACTER;
+        for (std::size_t i = 1; i < w; ++i) {
+            unsigned char const ci = p[i];
+            if ((ci & 0xc0) != 0x80)
+                return REPLACEMENT_CHARACTER;
+            c = (c << 6) | (ci & 0x3f);
+        }
+        if (c < lo || c > 0x10ffff || (0xd800 <= c && c <= 0xdfff))
+            return REPLACEMENT_CHARACTER;
+        width = w;
+        return static_cast<wchar_t> (c);
+    }
+
+    // back over continuation bytes to the lead byte, and decode forward.
+    static wchar_t decodeback (char const* p, std::size_t const n, std::size_t& width)
+    {
+        std::size_t k = 1;
+        while (k < 4 && k < n && (static_cast<unsigned char> (p[-k]) & 0xc0) == 0x80)
+            ++k;
+        wchar_t const c = decode (p - k, k, width);
+        if (width == k)
+            return c;
+        width = 1;
+        unsigned char const c1 = p[-1];
+        return c1 < 0x80 ? c1 : REPLACEMENT_CHARACTER;
+    }
+
+    static std::size_t encode (wchar_t const c0, char* p)
+    {
+        unsigned long const c = c0;
+        if (c < 0x80) {
+            p[0] = static_cast<char> (c);
+            return 1;
+        }
+        std::size_t const w = c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+        static unsigned char const lead[] = {0, 0, 0xc0, 0xe0, 0xf0};
+        for (std::size_t i = w - 1; i > 0; --i)
+            p[i] = static_cast<char> (0x80 | ((c >> (6 * (w - 1 - i))) & 0x3f));
+        p[0] = static_cast<char> (lead[w] | (c >> (6 * (w - 1))));
+        return w;
+    }
+};
+
+template<typename charT>
+std::wstring widen_units (std::basic_string<charT> const& s)
+{
+    std::wstring t;
+    t.reserve (s.size ());
+    for (std::size_t i = 0, w; i < s.size (); i += w)
+        t.push_back (codec<charT>::decode (s.data () + i, s.size () - i, w));
+    return t;
+}
+
+std::wstring widen (std::string const& s) { return widen_units (s); }
+std::wstring widen (std::u16string const& s) { return widen_units (s); }
+std::wstring widen (std::u32string const& s) { return widen_units (s); }
+
+// thrown when the vm runs out of the budget given by wregex::limit.
+struct vmabort {};
+
+// resumable state of the unanchored leftmost-first search.
+// see epsilon_closure::search ().
+struct vmsearch {
+    vmthread_que run;       // threads at sp after their epsilon closures
+    vmthread_que rdy;
+    string_pointer sp;      // current position
+    string_pointer nonnull; // an empty match is rejected at here
+    bool primed;            // run holds the closure of the start thread at sp
+    bool match;
+    vmthread th0;           // the captures of the match
+
+    vmsearch () : sp (0), nonnull (std::wstring::npos), primed (false), match (false), th0 () {}
+};
+
+// the characters a CHAR, CCLASS, or NCCLASS instruction accepts as ranges,
+// for the vectorized scan of runs, see epsilon_closure::skiprun ().
+// exact is false when the class has posix names or icase,
+// and then the scan looks at characters one by one with cclass ().
+struct runset {
+    bool exact;
+    bool negate;
+    std::vector<std::pair<wchar_t, wchar_t>> range;
+};
+
+// a character keeps the run when its membership in set is inside,
+// that is op consumes it as it has consumed the first one.
+struct runtest {
+    runset const* set;
+    bool inside;
+    instruction const* op;
+};
+
+static bool inrunset (runset const& rs, wchar_t const c)
+{
+    for (auto const& r : rs.range)
+        if (r.first <= c && c <= r.second)
+            return true;
+    return false;
+}
+
+// the number of leading units of p[0, n) keeping the run for all tests.
+// units of 32 bits are compared by SSE2 or AVX2 as signed wchar_t,
+// in the same way as cclass () does.
+template<typename T>
+static std::size_t scanrun (T const* p, std::size_t const n, std::vector<runtest> const& t)
+{
+    std::size_t i = 0;
+#if defined (__AVX2__)
+    if (sizeof (T) == 4)
+        for (; i + 8 <= n; i += 8) {
+            __m256i const c = _mm256_loadu_si256 (reinterpret_cast<__m256i const*> (p + i));
+            __m256i const ones = _mm256_set1_epi32 (-1);
+            __m256i ok = ones;
+            for (auto const& x : t) {
+                __m256i in = _mm256_setzero_si256 ();
+                for (auto const& r : x.set->range) {
+                    __m256i const out = _mm256_or_si256 (
+                        _mm256_cmpgt_epi32 (_mm256_set1_epi32 (r.first), c),
+                        _mm256_cmpgt_epi32 (c, _mm256_set1_epi32 (r.second)));
+                    in = _mm256_or_si256 (in, _mm256_xor_si256 (out, ones));
+                }
+                ok = _mm256_and_si256 (ok, x.inside ? in : _mm256_xor_si256 (in, ones));
+            }
+            unsigned const mask = _mm256_movemask_ps (_mm256_castsi256_ps (ok));
+            if (mask != 0xff) {
+                while (mask & (1U << (i & 7)))
+                    ++i;
+                return i;
+            }
+        }
+#elif defined (__SSE2__)
+    if (sizeof (T) == 4)
+        for (; i + 4 <= n; i += 4) {
+            __m128i const c = _mm_loadu_si128 (reinterpret_cast<__m128i const*> (p + i));
+            __m128i const ones = _mm_set1_epi32 (-1);
+            __m128i ok = ones;
+            for (auto const& x : t) {
+                __m128i in = _mm_setzero_si128 ();
+                for (auto const& r : x.set->range) {
+                    __m128i const out = _mm_or_si128 (
+                        _mm_cmplt_epi32 (c, _mm_set1_epi32 (r.first)),
+                        _mm_cmpgt_epi32 (c, _mm_set1_epi32 (r.second)));
+                    in = _mm_or_si128 (in, _mm_xor_si128 (out, ones));
+                }
+                ok = _mm_and_si128 (ok, x.inside ? in : _mm_xor_si128 (in, ones));
+            }
+            unsigned const mask = _mm_movemask_ps (_mm_castsi128_ps (ok));
+            if (mask != 0xf) {
+                while (mask & (1U << (i & 3)))
+                    ++i;
+                return i;
+            }
+        }
+#endif
+    for (; i < n; ++i)
+        for (auto const& x : t)
+            if (inrunset (*x.set, static_cast<wchar_t> (p[i])) != x.inside)
+                return i;
+    return n;
+}
+
+// the scratch state of the vm is reusable for another subject string.
+// bind () switches the subject, then advance () runs on it.
+// mark and thread queues keep their capacities over subjects.
+//
+// threads in a nested parentheses pattern (?*..) are identified by
+// their instruction pointers and their nesting depths, so that mark has
+// slots for each depth from 0 to wregex::nest_depth.
+// threads in an interval loop are identified by their counters likewise.
+//
+// the captures of threads are in the log, see capture_log. it is compacted
+// between the steps of the outermost advance () or of search (), where
+// the queues of the step and the match hold all live captures.
+//
+// the subject is the retained slice of a text from the absolute position base.
+// for a stream, final is false until the last chunk arrives and the vm
+// reports starved when it needs characters after the retained slice.
+// characters before the slice are treated as the beginning of the text.
+//
+// window () narrows the subject to [lo, hi), where \A and \z are at its
+// bounds. with context, lookbehinds and \b look at the characters out of it.
+//
+// the subject is a string of charT, see codec.
+template<typename charT>
+class basic_epsilon_closure {
 public:
-    epsilon_closure (program const& e0, std::wstring const& s0, t42::wregex::flag_type f)
-        : e (e0), s (s0), flag (f), gen (1), mark (e0.size (), 0) {}
-    bool advance (vmthread& th0, string_pointer const sp0, int const d);
+    typedef std::basic_string<charT> string_type;
+    enum { SEARCH_MATCH, SEARCH_FAIL, SEARCH_MORE };
+    // how to advance
+    //  EARLIEST    stop at the first MATCH of any thread
+    //  FULL        MATCH only at the end of the subject
+    //  LONGEST     MATCH does not cut off threads, and the last one wins
+    enum { LEFTMOST = 0, EARLIEST = 1, FULL = 2, LONGEST = 4 };
+    basic_epsilon_closure (program const& e0, t42::wregex::flag_type f)
+        : flag (f), e (e0), sbuf (nullptr), base (0), lo (0), hi (0), origin (0),
+          final (true), context (false), starved (false),
+          capturing (true), positional (false), searching (false), gen (1), lastgen (1), level (0),
+          ticks (0), tickcap (std::numeric_limits<unsigned long>::max ()),
+          maxticks (std::numeric_limits<unsigned long>::max ()),
+          deadline (std::chrono::steady_clock::time_point::max ())
+    {
+        setup_mark ();
+        setup_runsets ();
+    }
+    void bind (string_type const& s0) { bind (s0, 0, true); }
+    void bind (string_type const& s0, string_pointer const b, bool const f)
+    {
+        sbuf = &s0;
+        base = b;
+        lo = b;
+        hi = b + s0.size ();
+        origin = 0;
+        final = f;
+        context = false;
+        if (bkref && (flag & t42::wregex::icase))
+            setup_fold ();
+    }
+    void window (string_pointer const sp, string_pointer const ep, bool const ctx)
+    {
+        origin = lo = std::max (base, sp);
+        hi = std::min (hi, ep);
+        context = ctx;
+    }
+    bool advance (vmthread& th0, string_pointer const sp0, int const d,
+        int const how = LEFTMOST);
+    int search (vmsearch& st);
+    bool nocapture ();
+    void limit (t42::wregex::limit const& x);
+    capture_ref start (string_pointer const sp) { return caps.start (sp); }
+    string_pointer capture (capture_ref const x, std::size_t const i) const { return caps.get (x, i); }
+    void captures (capture_ref const x, capture_list& m) const { caps.get (x, m); }
 private:
     t42::wregex::flag_type flag;
     program const& e;
-    std::wstring const& s;
-    int gen;
-    std::vector<int> mark;
+    string_type const* sbuf;
+    string_type fold;
+    string_pointer base;
+    string_pointer lo;
+    string_pointer hi;
+    string_pointer origin;
+    bool final;
+    bool context;
+    bool starved;
+    bool capturing;
+    bool positional;
+    bool searching;
+    // 64 bits do not wrap on a vm reused by a stream or a batch worker,
+    // where a stale mark would collide with the current generation.
+    std::uint64_t gen;
+    std::uint64_t lastgen;
+    std::vector<std::uint64_t> mark;
+    std::vector<runset> runsets;
+    std::vector<runtest> runtests;
+    std::vector<std::size_t> markbase;
+    std::vector<std::vector<std::pair<int, int>>> nestreg;
+    bool nested;
+    bool bkref;
+    std::deque<vmthread_que> quepool;
+    capture_log caps;
+    std::vector<capture_ref*> roots;
+    std::size_t level;
+    unsigned long ticks;
+    unsigned long tickcap;
+    unsigned long maxticks;
+    std::chrono::steady_clock::time_point deadline;
+    string_pointer step (vmthread_que& run, vmthread_que& rdy, string_pointer const sp,
+        int const d, int const how, vmthread& th0, bool& match, string_pointer const nonnull);
     void addthread (vmthread_que& q, vmthread&& th, string_pointer const sp, int const d);
-    bool cclass (std::wstring const& span, wchar_t const c) const;
-    bool atwordbound (string_pointer const sp) const;
-    int backref (vmthread const& th, string_pointer const sp, int d) const;
+    void compact (vmthread_que& run, vmthread* th0);
+    void setup_mark ();
+    void setup_fold ();
+    void setup_runsets ();
+    string_pointer skiprun (vmthread_que const& run, vmthread_que const& rdy,
+        string_pointer const sp, string_pointer const next);
+    bool consumes (instruction const& op, wchar_t const c) const;
+    std::size_t markindex (vmthread const& th) const;
+    bool atwordbound (string_pointer const sp);
+    bool backref (vmthread const& th, string_pointer const sp1, int const d,
+        std::size_t& wait, std::size_t& ahead) const;
 
-    bool wchar_equal (wchar_t c0, wchar_t c1) const
+    // count an instruction, it costs a compare while no limits are set.
+    void tick ()
     {
-        if (flag & t42::wregex::icase) {
-            c0 = std::towlower (c0);
-            c1 = std::towlower (c1);
-        }
-        return c0 == c1;
+        if (++ticks >= tickcap)
+            checkpoint ();
+    }
+
+    void checkpoint ();
+
+    bool has (string_pointer const i) const { return lo <= i && i < hi; }
+    charT at (string_pointer const i) const { return (*sbuf)[i - base]; }
+
+    // the character from i, and the one ending before i.
+    wchar_t decode (string_pointer const i, std::size_t& w) const
+    {
+        return codec<charT>::decode (sbuf->data () + (i - base), hi - i, w);
     }
 
-    bool wchar_between (wchar_t c, wchar_t from, wchar_t to) const
+    wchar_t decodeback (string_pointer const i, std::size_t& w) const
     {
-        if (flag & t42::wregex::icase) {
-            c = std::towlower (c);
-            from = std::towlower (from);
-            to = std::towlower (to);
-        }
-        return from <= c && c <= to;
+        return codec<charT>::decodeback (sbuf->data () + (i - base), i - lo, w);
+    }
+
+    // whether the position sp is at the end of the text.
+    // the vm is starved when it is not decided yet.
+    bool atend (string_pointer const sp)
+    {
+        if (has (sp))
+            return false;
+        if (! final && sp >= base)
+            starved = true;
+        return final;
     }
 };
 
+typedef basic_epsilon_closure<wchar_t> epsilon_closure;
+
 // based on Russ Cox, ``Regular Expression Matching: the Virtual Machine Approach''
 //      http://swtch.com/~rsc/regexp/regexp2.html  Pike VM
-bool epsilon_closure::advance (vmthread& th0, string_pointer const sp0, int const d)
+template<typename charT>
+bool basic_epsilon_closure<charT>::advance (vmthread& th0, string_pointer const sp0, int const d,
+    int const how)
 {
-    string_pointer match = false;
-    vmthread_que run, rdy;
+    // lookarounds call advance recursively, so that each level has own queues.
+    if (quepool.size () < level * 2 + 2)
+        quepool.resize (level * 2 + 2);
+    vmthread_que& run = quepool[level * 2];
+    vmthread_que& rdy = quepool[level * 2 + 1];
+    run.clear ();
+    rdy.clear ();
+    ++level;
+    // the caller's generation is restored at return, because its marks
+    // must survive the generations used by this lookaround.
+    std::uint64_t const gen0 = gen;
+    gen = ++lastgen;
+    bool match = false;
     addthread (run, vmthread{th0.ip, th0.cap, th0.cnt}, sp0, d);
-    for (string_pointer sp = sp0; ; sp += d) {
-        if (run.empty ())
-            break;
-        ++gen;
+    for (string_pointer sp = sp0, next; ! run.empty (); sp = next) {
         //  d > 0   "abc"|"d">"efg"     s[sp] == op.s[0]
         //  d < 0   "abc"<"d"|"efg"     s[sp-1] == op.s[0]
         string_pointer sp1 = d > 0 ? sp : sp - 1;
-        for (vmthread th : run) {
-            int ct;
-            instruction op = e[th.ip];
-            switch (op.opcode) {
-            case CHAR:
-                if (sp1 < s.size () && wchar_equal (s[sp1], op.s[0]))
-                    addthread (rdy, vmthread{th.ip + 1, th.cap, th.cnt}, sp + d, d);
+        if (d > 0 && ! has (sp1) && ! final) {
+            // a lookahead runs out of the retained slice of a stream.
+            // it is decided only when one of threads has matched, and
+            // for its captures, when no thread has priority over that one.
+            bool decided = match && (EARLIEST & how);
+            for (std::size_t i = 0; i < run.size (); ++i)
+                if (MATCH == e[run[i].ip].opcode) {
+                    if (i == 0 || (EARLIEST & how)) {
+                        th0.cap = caps.save (run[i].cap, 1, sp);
+                        match = decided = true;
+                    }
+                    break;
+                }
+            starved = starved || ! decided;
+            break;
+        }
+        gen = ++lastgen;
+        next = step (run, rdy, sp, d, how, th0, match, std::wstring::npos);
+        if (d > 0 && ! (match && (EARLIEST & how)))
+            next = skiprun (run, rdy, sp, next);
+        std::swap (run, rdy);
+        rdy.clear ();
+        if (level == 1 && ! searching && caps.due ())
+            compact (run, &th0);
+        if (! has (sp1) || (match && (EARLIEST & how)))
+            break;
+    }
+    run.clear ();
+    gen = gen0;
+    --level;
+    return match;
+}
+
+// threads in run consume the character at sp, and their successors
+// are put into rdy in the order of their priorities.
+// MATCH cuts off the lower priority threads.
+// returns the position after the character.
+template<typename charT>
+string_pointer basic_epsilon_closure<charT>::step (vmthread_que& run, vmthread_que& rdy,
+    string_pointer const sp, int const d, int const how, vmthread& th0, bool& match,
+    string_pointer const nonnull)
+{
+    string_pointer sp1 = d > 0 ? sp : sp - 1;
+    bool const ready = has (sp1);
+    std::size_t w = 1;
+    wchar_t const c = ! ready ? 0 : d > 0 ? decode (sp, w) : decodeback (sp, w);
+    string_pointer const next = d > 0 ? sp + w : sp - w;
+    bool matchhere = false;
+    positional = false;
+    for (vmthread const& th : run) {
+        tick ();
+        instruction const& op = e[th.ip];
+        switch (op.opcode) {
+        case CHAR:
+            if (ready && wchar_equal (c, op.s[0], flag))
+                addthread (rdy, vmthread{th.ip + 1, th.cap, th.cnt}, next, d);
+            break;
+        case ANY:
+            if (ready)
+                addthread (rdy, vmthread{th.ip + 1, th.cap, th.cnt}, next, d);
+            break;
+        case CCLASS:
+        case NCCLASS:
+            if (ready && (cclass (op.s, c, flag) ^ (op.opcode == NCCLASS)))
+                addthread (rdy, vmthread{th.ip + 1, th.cap, th.cnt}, next, d);
+            break;
+        case BKREF:
+            {
+                std::size_t wait = th.wait;
+                std::size_t ahead = th.ahead;
+                if (! ready || ! backref (th, sp1, d, wait, ahead))
+                    break;
+                // the thread waiting the rest of the slice is not marked,
+                // because it differs from threads just arriving to BKREF.
+                if (wait > w)
+                    rdy.push_back (vmthread{th.ip, th.cap, th.cnt,
+                        wait - w, ahead - std::min (ahead, w)});
+                else if (wait == w)
+                    addthread (rdy, vmthread{th.ip + 1, th.cap, th.cnt}, next, d);
+            }
+            break;
+        case MATCH:
+            if (sp == nonnull && caps.get (th.cap, 0) == sp) {
+                positional = true;
                 break;
-            case ANY:
-                if (sp1 < s.size ())
-                    addthread (rdy, vmthread{th.ip + 1, th.cap, th.cnt}, sp + d, d);
+            }
+            if ((FULL & how) && has (sp))
                 break;
-            case CCLASS:
-            case NCCLASS:
-                if (sp1 < s.size () && (cclass (op.s, s[sp1]) ^ (op.opcode == NCCLASS)))
-                    addthread (rdy, vmthread{th.ip + 1, th.cap, th.cnt}, sp + d, d);
+            if (matchhere)
                 break;
-            case BKREF:
-                ct = backref (th, sp1, d);
-                if (ct > 0)
-                    addthread (rdy, vmthread{th.ip, th.cap, th.preset (op.r, ct)}, sp + d, d);
-                else if (ct == 0)
-                    addthread (rdy, vmthread{th.ip + 1, th.cap, th.cnt}, sp + d, d);
+            th0.cap = caps.save (th.cap, 1, sp);
+            match = true;
+            if (LONGEST & how) {
+                matchhere = true;
                 break;
-            case MATCH:
-                th0.cap = th.update (1, sp);
-                match = true;
-                goto cutoff_lower_order_threads;
-            default:
-                throw "JMP, SPLIT, SAVE, and so on already with addthread.. but why?";
             }
+            return next;
+        default:
+            throw "JMP, SPLIT, SAVE, and so on already with addthread.. but why?";
         }
-    cutoff_lower_order_threads:
-        std::swap (run, rdy);
-        rdy.clear ();
-        if (sp1 >= s.size ())
-            break;
     }
-    return match;
+    return next;
+}
+
+// search the leftmost-first match from st.sp in the bound subject.
+// a new thread starts at each position with the lowest priority,
+// until one of threads matches.
+//
+// SEARCH_MATCH   st.th0.cap has the captures, and st is ready for the next.
+// SEARCH_FAIL    there are no more matches.
+// SEARCH_MORE    the stream needs the next chunk to decide.
+//
+// after an empty match, the next one must not be empty at the same position.
+template<typename charT>
+int basic_epsilon_closure<charT>::search (vmsearch& st)
+{
+    enum { START = 0 };
+    searching = true;
+    for (;;) {
+        if (! st.primed) {
+            if (! has (st.sp) && ! final)
+                return SEARCH_MORE;
+            if (st.sp > hi)
+                return SEARCH_FAIL;
+            starved = false;
+            gen = ++lastgen;
+            st.run.clear ();
+            addthread (st.run, vmthread{START, caps.start (st.sp),
+                std::make_shared<counter_list> ()}, st.sp, +1);
+            if (starved) {
+                st.run.clear ();
+                return SEARCH_MORE;
+            }
+            st.primed = true;
+        }
+        if (st.run.empty ()) {
+            if (st.match) {
+                string_pointer const sp0 = caps.get (st.th0.cap, 0);
+                string_pointer const sp1 = caps.get (st.th0.cap, 1);
+                st.sp = sp1;
+                st.nonnull = sp0 == sp1 ? sp1 : std::wstring::npos;
+                st.primed = false;
+                st.match = false;
+                return SEARCH_MATCH;
+            }
+            if (! has (st.sp))
+                return final ? SEARCH_FAIL : SEARCH_MORE;
+            std::size_t w;
+            decode (st.sp, w);
+            st.sp += w;
+            st.primed = false;
+            continue;
+        }
+        string_pointer const sp = st.sp;
+        if (! has (sp) && ! final)
+            return SEARCH_MORE;
+        bool const match0 = st.match;
+        capture_ref const cap0 = st.th0.cap;
+        starved = false;
+        gen = ++lastgen;
+        st.rdy.clear ();
+        string_pointer const next = step (st.run, st.rdy, sp, +1, LEFTMOST,
+            st.th0, st.match, st.nonnull);
+        if (! st.match && has (sp))
+            addthread (st.rdy, vmthread{START, caps.start (next),
+                std::make_shared<counter_list> ()}, next, +1);
+        // the closure at next may look at the characters after the slice.
+        if (starved) {
+            st.match = match0;
+            st.th0.cap = cap0;
+            st.rdy.clear ();
+            return SEARCH_MORE;
+        }
+        string_pointer const skip = skiprun (st.run, st.rdy, sp, next);
+        std::swap (st.run, st.rdy);
+        st.rdy.clear ();
+        st.sp = skip;
+        if (caps.due ())
+            compact (st.run, st.match ? &st.th0 : nullptr);
+    }
+}
+
+// the roots of the live captures are the threads of run and the match.
+template<typename charT>
+void basic_epsilon_closure<charT>::compact (vmthread_que& run, vmthread* th0)
+{
+    roots.clear ();
+    for (vmthread& th : run)
+        roots.push_back (&th.cap);
+    if (th0)
+        roots.push_back (&th0->cap);
+    caps.compact (roots);
 }
 
-void epsilon_closure::addthread (vmthread_que& q, vmthread&& th, string_pointer const sp, int const d)
+template<typename charT>
+void basic_epsilon_closure<charT>::addthread (vmthread_que& q, vmthread&& th, string_pointer const sp, int const d)
 {
-    if (mark[th.ip] == gen)
+    std::size_t const k = nested ? markindex (th) : th.ip;
+    if (mark[k] == gen)
         return;
-    mark[th.ip] = gen;
-    instruction op = e[th.ip];
+    mark[k] = gen;
+    tick ();
+    instruction const& op = e[th.ip];
     switch (op.opcode) {
     default:
         q.push_back (std::move (th));
         break;
     case BOL:
-        if (sp - 1 >= s.size () || L'\n' == s[sp - 1])
+        positional = true;
+        if (! has (sp - 1) || L'\n' == at (sp - 1))
             addthread (q, vmthread{th.ip + 1, th.cap, th.cnt}, sp, d);
         break;
     case EOL:
-        if (sp >= s.size () || L'\n' == s[sp])
+        positional = true;
+        if (atend (sp) || (has (sp) && L'\n' == at (sp)))
             addthread (q, vmthread{th.ip + 1, th.cap, th.cnt}, sp, d);
         break;
     case BOS:
-        if (sp == 0)
+        positional = true;
+        if (sp == origin)
             addthread (q, vmthread{th.ip + 1, th.cap, th.cnt}, sp, d);
         break;
     case EOS:
-        if (sp >= s.size ())
+        positional = true;
+        if (atend (sp))
             addthread (q, vmthread{th.ip + 1, th.cap, th.cnt}, sp, d);
         break;
     case WORDB:
     case NWORDB:
+        positional = true;
         if (atwordbound (sp) ^ (NWORDB == op.opcode))
             addthread (q, vmthread{th.ip + 1, th.cap, th.cnt}, sp, d);
         break;
@@ -192,7 +865,9 @@ void epsilon_closure::addthread (vmthread_que& q, vmthread&& th, string_pointer
     case NLKAHEAD:
         {
             vmthread th1{op.x + th.ip + 1, th.cap, th.cnt};
-            if (advance (th1, sp, +1) ^ (NLKAHEAD == op.opcode))
+            bool const x = advance (th1, sp, +1, capturing ? LEFTMOST : EARLIEST);
+            positional = true;
+            if (x ^ (NLKAHEAD == op.opcode))
                 addthread (q, vmthread{op.y + th.ip + 1, th1.cap, th1.cnt}, sp, d);
         }
         break;
@@ -200,7 +875,13 @@ void epsilon_closure::addthread (vmthread_que& q, vmthread&& th, string_pointer
     case NLKBEHIND:
         {
             vmthread th1{op.x + th.ip + 1, th.cap, th.cnt};
-            if (advance (th1, sp, -1) ^ (NLKBEHIND == op.opcode))
+            string_pointer const lo0 = lo;
+            if (context)
+                lo = base;
+            bool const x = advance (th1, sp, -1, capturing ? LEFTMOST : EARLIEST);
+            lo = lo0;
+            positional = true;
+            if (x ^ (NLKBEHIND == op.opcode))
                 addthread (q, vmthread{op.y + th.ip + 1, th1.cap, th1.cnt}, sp, d);
         }
         break;
@@ -215,8 +896,10 @@ void epsilon_closure::addthread (vmthread_que& q, vmthread&& th, string_pointer
                 addthread (q, vmthread{th.ip + 2, th.cap, cnt}, sp, d);
             else if (op.y == -1 || i <= op.y)
                 addthread (q, vmthread{th.ip + 1, th.cap, cnt}, sp, d);
-            else if (op.x == op.y)
-                addthread (q, vmthread{th.ip + 2 + e[th.ip + 1].y, th.cap, cnt}, sp, d);
+            else {
+                int const out = std::max (e[th.ip + 1].x, e[th.ip + 1].y);
+                addthread (q, vmthread{th.ip + 2 + out, th.cap, cnt}, sp, d);
+            }
         }
         break;
     case DECJMP:
@@ -224,6 +907,8 @@ void epsilon_closure::addthread (vmthread_que& q, vmthread&& th, string_pointer
         {
             int const di = DECJMP == op.opcode ? -1 : +1;
             int const i = th.cnt->at (op.r) + di;
+            if (i > t42::wregex::nest_depth)
+                break;
             counter_ptr cnt = th.preset (op.r, i);
             if (i > 0)
                 addthread (q, vmthread{th.ip + 1 + op.x, th.cap, cnt}, sp, d);
@@ -239,17 +924,326 @@ void epsilon_closure::addthread (vmthread_que& q, vmthread&& th, string_pointer
         addthread (q, vmthread{th.ip + 1 + op.y, th.cap, th.cnt}, sp, d);
         break;
     case SAVE:
-        addthread (q, vmthread{th.ip + 1, th.update (op.x, sp), th.cnt}, sp, d);
+        addthread (q, vmthread{th.ip + 1, capturing ? caps.save (th.cap, op.x, sp) : th.cap, th.cnt}, sp, d);
         break;
     }
 }
 
+// the regions of nested parentheses patterns from their DECJMPs,
+// and those of interval loops from their REPs.
+//
+//      RESET   %r
+//      JMP     L3
+//  L1  SPLIT   +0,L2       <- region begins
+//      ...
+//      DECJMP  L1,L5,%r
+//      ...
+//      JMP     L1
+//  L5                      <- region ends
+//
+// an interval loop is also a region, where threads at the same position
+// are distinguished by their counters up to its bound, so that a thread
+// with more iterations done is not lost, and the remaining iterations
+// can be empty. a loop bound over MAXBOUND is not distinguished.
+//
+//      RESET   %r
+//  L1  REP     m,n,%r      <- region begins
+//      SPLIT   L2,L3
+//  L2  e
+//      JMP     L1
+//  L3                      <- region ends
+//
+// an instruction in regions has the product of their widths slots in mark.
+// only the innermost regions up to MAXSLOT slots are distinguished.
+// nestreg gets the registers and the widths of the regions of instructions.
+bool markregions (program const& e, std::vector<std::vector<std::pair<int, int>>>& nestreg)
+{
+    enum { MAXBOUND = 255, MAXSLOT = 4096 };
+    std::size_t const n = e.size ();
+    nestreg.assign (n, std::vector<std::pair<int, int>> ());
+    std::vector<std::pair<std::size_t, std::size_t>> region;
+    std::vector<std::pair<int, int>> reg;
+    for (std::size_t ip = 0; ip < n; ++ip)
+        if (DECJMP == e[ip].opcode) {
+            region.push_back (std::make_pair (ip + 1 + e[ip].x, ip + 1 + e[ip].y));
+            reg.push_back (std::make_pair (e[ip].r, t42::wregex::nest_depth + 1));
+        }
+        else if (REP == e[ip].opcode) {
+            int const bound = e[ip].y == -1 ? e[ip].x + 1 : e[ip].y;
+            if (bound <= MAXBOUND) {
+                region.push_back (std::make_pair (ip, ip + 2 + std::max (e[ip + 1].x, e[ip + 1].y)));
+                reg.push_back (std::make_pair (e[ip].r, bound + 1));
+            }
+        }
+    // innermost regions are smaller than outer ones.
+    std::vector<std::size_t> order (region.size ());
+    for (std::size_t i = 0; i < order.size (); ++i)
+        order[i] = i;
+    std::sort (order.begin (), order.end (), [&] (std::size_t a, std::size_t b) {
+        return region[a].second - region[a].first < region[b].second - region[b].first;
+    });
+    std::vector<int> slot (n, 1);
+    for (auto i : order)
+        for (std::size_t ip = region[i].first; ip < region[i].second && ip < n; ++ip)
+            if (slot[ip] * reg[i].second <= MAXSLOT) {
+                nestreg[ip].push_back (reg[i]);
+                slot[ip] *= reg[i].second;
+            }
+    return ! region.empty ();
+}
+
+template<typename charT>
+void basic_epsilon_closure<charT>::setup_mark ()
+{
+    std::size_t const n = e.size ();
+    nested = markregions (e, nestreg);
+    bkref = false;
+    for (auto const& op : e)
+        bkref = bkref || BKREF == op.opcode;
+    markbase.assign (n + 1, 0);
+    for (std::size_t ip = 0; ip < n; ++ip) {
+        std::size_t w = 1;
+        for (auto const& r : nestreg[ip])
+            w *= r.second;
+        markbase[ip + 1] = markbase[ip] + w;
+    }
+    mark.assign (markbase[n], 0);
+}
+
+template<typename charT>
+std::size_t basic_epsilon_closure<charT>::markindex (vmthread const& th) const
+{
+    std::size_t k = markbase[th.ip];
+    std::size_t w = 1;
+    for (auto const& r : nestreg[th.ip]) {
+        int x = static_cast<std::size_t> (r.first) < th.cnt->size () ? (*th.cnt)[r.first] : 0;
+        x = std::max (0, std::min<int> (x, r.second - 1));
+        k += w * x;
+        w *= r.second;
+    }
+    return k;
+}
+
+// fold the subject to lower case for icase backreferences.
+// a character is left as it is when its lower case has another width,
+// so that positions in the folded text are the same as in the subject.
+template<typename charT>
+void basic_epsilon_closure<charT>::setup_fold ()
+{
+    fold.assign (*sbuf);
+    charT u[4];
+    for (std::size_t i = 0, w; i < fold.size (); i += w) {
+        wchar_t const c = codec<charT>::decode (sbuf->data () + i, sbuf->size () - i, w);
+        if (codec<charT>::encode (std::towlower (c), u) == w)
+            std::copy (u, u + w, fold.begin () + i);
+    }
+}
+
+// the ranges of consuming instructions for skiprun ().
+template<typename charT>
+void basic_epsilon_closure<charT>::setup_runsets ()
+{
+    enum { MAXRANGE = 16 };
+    bool const icase = (flag & t42::wregex::icase) != 0;
+    runsets.assign (e.size (), runset{false, false, {}});
+    for (std::size_t ip = 0; ip < e.size (); ++ip) {
+        instruction const& op = e[ip];
+        runset& rs = runsets[ip];
+        if (CHAR == op.opcode && ! icase) {
+            rs.exact = true;
+            rs.range.push_back (std::make_pair (op.s[0], op.s[0]));
+        }
+        else if ((CCLASS == op.opcode || NCCLASS == op.opcode) && ! icase) {
+            rs.exact = true;
+            rs.negate = NCCLASS == op.opcode;
+            std::wstring const& span = op.s;
+            for (auto p = span.begin (); p < span.end (); ++p)
+                switch (*p) {
+                case L'\\':
+                    ++p;
+                    rs.range.push_back (std::make_pair (*p, *p));
+                    break;
+                case L':':
+                    ++p;
+                    rs.exact = false;
+                    break;
+                case L'-':
+                    if (L'\\' == p[-2] && L'\\' == p[1]) {
+                        rs.range.push_back (std::make_pair (p[-1], p[2]));
+                        p += 2;
+                    }
+                }
+            rs.exact = rs.exact && rs.range.size () <= MAXRANGE;
+        }
+    }
+}
+
+template<typename charT>
+bool basic_epsilon_closure<charT>::consumes (instruction const& op, wchar_t const c) const
+{
+    switch (op.opcode) {
+    case CHAR:
+        return wchar_equal (c, op.s[0], flag);
+    case CCLASS:
+    case NCCLASS:
+        return cclass (op.s, c, flag) ^ (NCCLASS == op.opcode);
+    default:
+        return true;
+    }
+}
+
+// when the step at sp has left run as it was, run stays for the following
+// characters as far as every consuming thread gives the same result.
+// returns the position of the last one of them, so that the next step
+// there records the match as stepping through all of them does.
+// the skipped steps are charged to the budget.
+//
+//      [0-9a-f]+       run = {CCLASS loop, MATCH}
+//      [^,]*,          run = {NCCLASS loop, CHAR ','}
+//
+// it is not taken when the closure has looked at the position,
+// or threads have updated captures or counters.
+template<typename charT>
+string_pointer basic_epsilon_closure<charT>::skiprun (vmthread_que const& run,
+    vmthread_que const& rdy, string_pointer const sp, string_pointer const next)
+{
+    if (positional || run.empty () || run.size () != rdy.size () || ! has (sp) || ! has (next))
+        return next;
+    for (std::size_t i = 0; i < run.size (); ++i)
+        if (run[i].ip != rdy[i].ip || run[i].cap != rdy[i].cap || run[i].cnt != rdy[i].cnt
+                || run[i].wait || rdy[i].wait || BKREF == e[run[i].ip].opcode)
+            return next;
+    std::size_t w;
+    wchar_t const c = decode (sp, w);
+    bool exact = sizeof (charT) == 4;
+    runtests.clear ();
+    for (vmthread const& th : run) {
+        instruction const& op = e[th.ip];
+        if (MATCH == op.opcode || ANY == op.opcode)
+            continue;
+        runset const& rs = runsets[th.ip];
+        runtests.push_back (runtest{&rs, consumes (op, c) != rs.negate, &op});
+        exact = exact && rs.exact;
+    }
+    std::size_t n = 0;
+    string_pointer last = next;
+    if (exact) {
+        n = scanrun (sbuf->data () + (next - base), hi - next, runtests);
+        last = n ? next + n - 1 : next;
+    }
+    else
+        for (string_pointer p = next; has (p); p += w, ++n) {
+            wchar_t const c1 = decode (p, w);
+            bool same = true;
+            for (auto const& x : runtests)
+                same = same && consumes (*x.op, c1) == (x.inside ^ x.set->negate);
+            if (! same)
+                break;
+            last = p;
+        }
+    if (n > 1) {
+        ticks += (n - 1) * run.size ();
+        if (ticks >= tickcap)
+            checkpoint ();
+    }
+    return last;
+}
+
+// turn off capturing, SAVE passes through and threads have no capture lists.
+// backreferences need captures, so that it is not allowed with BKREF.
+template<typename charT>
+bool basic_epsilon_closure<charT>::nocapture ()
+{
+    if (bkref)
+        return false;
+    capturing = false;
+    return true;
+}
+
+// the budget of the number of instructions and the deadline.
+// the clock is looked at each TICKSPAN instructions.
+template<typename charT>
+void basic_epsilon_closure<charT>::limit (t42::wregex::limit const& x)
+{
+    ticks = 0;
+    maxticks = x.steps ? x.steps : std::numeric_limits<unsigned long>::max ();
+    deadline = x.deadline;
+    checkpoint ();
+}
+
+template<typename charT>
+void basic_epsilon_closure<charT>::checkpoint ()
+{
+    enum { TICKSPAN = 1024 };
+    if (ticks >= maxticks)
+        throw vmabort ();
+    if (deadline != std::chrono::steady_clock::time_point::max ()) {
+        if (std::chrono::steady_clock::now () >= deadline)
+            throw vmabort ();
+        tickcap = std::min (maxticks, ticks + TICKSPAN);
+    }
+    else
+        tickcap = maxticks;
+}
+
 int iswword (std::wint_t c)
 {
     return (iswalnum (c) != 0) || L'_' == c;
 }
 
-bool epsilon_closure::cclass (std::wstring const& span, wchar_t const c) const
+bool wchar_equal (wchar_t c0, wchar_t c1, int const flag)
+{
+    if (flag & t42::wregex::icase) {
+        c0 = std::towlower (c0);
+        c1 = std::towlower (c1);
+    }
+    return c0 == c1;
+}
+
+wchar_t literal::fold (wchar_t const c) const
+{
+    return icase ? std::towlower (c) : c;
+}
+
+// whether the needle is at sp in s.
+bool literal::at (std::wstring const& s, std::wstring::size_type const sp) const
+{
+    std::size_t const n = needle.size ();
+    if (sp > s.size () || s.size () - sp < n)
+        return false;
+    for (std::size_t i = 0; i < n; ++i)
+        if (fold (s[sp + i]) != needle[i])
+            return false;
+    return true;
+}
+
+// the leftmost position of the needle in s from sp.
+std::wstring::size_type literal::find (std::wstring const& s, std::wstring::size_type const sp) const
+{
+    std::size_t const n = needle.size ();
+    if (sp > s.size ())
+        return std::wstring::npos;
+    for (std::wstring::size_type i = sp; s.size () - i >= n; ) {
+        wchar_t const c = fold (s[i + n - 1]);
+        if (c == needle[n - 1] && at (s, i))
+            return i;
+        i += shift[c & 0xff];
+    }
+    return std::wstring::npos;
+}
+
+static bool wchar_between (wchar_t c, wchar_t from, wchar_t to, int const flag)
+{
+    if (flag & t42::wregex::icase) {
+        c = std::towlower (c);
+        from = std::towlower (from);
+        to = std::towlower (to);
+    }
+    return from <= c && c <= to;
+}
+
+// whether c is in the span of CCLASS, see vmcompiler::cclass ().
+bool cclass (std::wstring const& span, wchar_t const c, int const flag)
 {
     static int (* const iswfunc[]) (std::wint_t) = {
         std::iswalnum, std::iswalpha, std::iswblank, std::iswcntrl,
@@ -260,7 +1254,7 @@ bool epsilon_closure::cclass (std::wstring const& span, wchar_t const c) const
     for (auto p = span.begin (); p < span.end (); ++p)
         switch (*p) {
         case L'\\':
-            if (wchar_equal (c, *++p))
+            if (wchar_equal (c, *++p, flag))
                 return true;
             break;
         case L':':
@@ -272,7 +1266,7 @@ bool epsilon_closure::cclass (std::wstring const& span, wchar_t const c) const
             break;
         case L'-':
             if (L'\\' == p[-2] && L'\\' == p[1]) {
-                if (wchar_between (c, p[-1], p[2]))
+                if (wchar_between (c, p[-1], p[2], flag))
                     return true;
                 p += 2;
             }
@@ -280,55 +1274,818 @@ bool epsilon_closure::cclass (std::wstring const& span, wchar_t const c) const
     return false;
 }
 
-bool epsilon_closure::atwordbound (string_pointer const sp) const
+template<typename charT>
+bool basic_epsilon_closure<charT>::atwordbound (string_pointer const sp)
 {
-    wchar_t c0 = sp - 1 < s.size () ? s[sp - 1] : L' ';
-    wchar_t c1 = sp < s.size () ? s[sp] : L' ';
+    std::size_t w;
+    string_pointer const lo0 = lo;
+    string_pointer const hi0 = hi;
+    if (context)
+        lo = base, hi = base + sbuf->size ();
+    wchar_t c0 = has (sp - 1) ? decodeback (sp, w) : L' ';
+    wchar_t c1 = ! atend (sp) && has (sp) ? decode (sp, w) : L' ';
+    lo = lo0, hi = hi0;
     return iswword (c0) ^ iswword(c1);
 }
 
-// return > 0   continue backref comparison
-// return == 0  match backref comparison
-// return < 0   failure backref comparison
-int epsilon_closure::backref (vmthread const& th, string_pointer const sp, int d) const
-{
-    int const r = e[th.ip].r; // counter register number
-    int const n = e[th.ip].x; // capture number
-    if (sp >= s.size () || n < 0 || n * 2 + 1 >= th.cap->size ())
-        return -1;
-    int const ct = th.cnt->at (r);
-    int const i1 = th.cap->at (n * 2);
-    int const i2 = th.cap->at (n * 2 + 1);
-    if (i1 < 0 || i1 >= i2 || ct >= i2 - i1)
-        return -1;
-    // ct      0123456
-    // "abc "|"backref">" def"  s[i1 + ct]
-    // ct       6543210
-    // "abc "<"backref"|" def"  s[i2 - ct - 1]
-    int const i = d > 0 ? i1 + ct : i2 - ct - 1;
-    if (! wchar_equal (s[sp], s[i]))
-        return -1;
-    if (ct < i2 - i1 - 1)
-        return ct + 1;
-    return 0;
+// a thread on BKREF consumes the captured slice a character by a step,
+// but it compares the slice with the subject at once.
+// wait is the number of code units rest to consume, 0 at the first step.
+// ahead is the number of them already compared. they are compared again
+// only when the stream has not retained the rest of the slice yet.
+//
+//     d > 0   "abc "|"backref">" def"   [sp1, sp1 + wait) with the tail of slice
+//     d < 0   "abc "<"backref"|" def"   (sp1 - wait, sp1] with the head of slice
+//
+// with icase, the subject is compared in the pre-folded text.
+// a character keeps its width in the folded text, see setup_fold ().
+template<typename charT>
+bool basic_epsilon_closure<charT>::backref (vmthread const& th, string_pointer const sp1, int const d,
+    std::size_t& wait, std::size_t& ahead) const
+{
+    std::size_t const n = e[th.ip].x; // capture number
+    string_pointer const i1 = caps.get (th.cap, n * 2);
+    string_pointer const i2 = caps.get (th.cap, n * 2 + 1);
+    if (i1 == std::wstring::npos || i2 == std::wstring::npos || i1 >= i2)
+        return false;
+    if (wait == 0) {
+        wait = i2 - i1;
+        ahead = 0;
+    }
+    if (ahead > 0)
+        return true;
+    std::size_t const k = i2 - i1 - wait;
+    std::size_t const avail = d > 0 ? hi - sp1 : sp1 - lo + 1;
+    std::size_t const len = std::min (wait, avail);
+    if (len < wait && (final || d < 0))
+        return false;
+    string_pointer const x = d > 0 ? sp1 : sp1 + 1 - len;
+    string_pointer const y = d > 0 ? i1 + k : i2 - k - len;
+    if (! has (y) || ! has (y + len - 1))
+        return false;
+    charT const* const text = (flag & t42::wregex::icase) ? fold.data () : sbuf->data ();
+    if (std::char_traits<charT>::compare (text + (x - base), text + (y - base), len) != 0)
+        return false;
+    ahead = len;
+    return true;
+}
+
+// the state of wregex_stream.
+// the vm keeps its thread queue between chunks, and the buffer retains
+// the text from the oldest captured position of live threads,
+// with the history window before it for lookbehinds and \b.
+struct vmstream {
+    program e;
+    epsilon_closure vm;
+    std::wstring buf;
+    string_pointer base;
+    std::size_t history;
+    bool final;
+    vmsearch st;
+    std::deque<capture_list> decided;
+
+    vmstream (program const& e0, t42::wregex::flag_type f, std::size_t const h)
+        : e (e0), vm (e, f), base (0), history (std::max<std::size_t> (1, h)), final (false) {}
+    std::size_t run ();
+    void trim ();
+};
+
+std::size_t vmstream::run ()
+{
+    std::size_t n = 0;
+    vm.bind (buf, base, final);
+    while (epsilon_closure::SEARCH_MATCH == vm.search (st)) {
+        decided.emplace_back ();
+        vm.captures (st.th0.cap, decided.back ());
+        ++n;
+    }
+    return n;
+}
+
+void vmstream::trim ()
+{
+    string_pointer keep = st.sp;
+    capture_list m;
+    for (vmthread const& th : st.run) {
+        vm.captures (th.cap, m);
+        for (auto x : m)
+            keep = std::min (keep, x);
+    }
+    if (st.match) {
+        vm.captures (st.th0.cap, m);
+        for (auto x : m)
+            keep = std::min (keep, x);
+    }
+    keep = keep > history ? keep - history : 0;
+    // erase when it is worth to move the rest.
+    if (keep > base && keep - base >= buf.size () / 2) {
+        buf.erase (0, keep - base);
+        base = keep;
+    }
+}
+
+// the state of wregex::iterator.
+// the vm scratch state and the search state live over successive matches.
+// a literal pattern is searched by its needle instead of the vm.
+// a suffix-anchored pattern searches the first match backward, see back ().
+// next (false) leaves m as it was, for count ().
+struct vmiter {
+    epsilon_closure vm;
+    vmsearch st;
+    capture_list m;
+    t42::wregex::flag_type flag;
+    literal const& lit;
+    suffix const& sfx;
+    std::wstring const& s;
+    bool fresh;
+
+    vmiter (program const& e, t42::wregex::flag_type f, literal const& l,
+        suffix const& x, std::wstring const& s0, string_pointer const sp)
+        : vm (e, f), flag (f), lit (l), sfx (x), s (s0), fresh (true)
+    {
+        vm.bind (s);
+        st.sp = sp;
+    }
+
+    bool next (bool const keep = true)
+    {
+        if (! lit.empty ()) {
+            string_pointer const i = lit.find (s, st.sp);
+            if (i == std::wstring::npos)
+                return false;
+            st.sp = i + lit.size ();
+            if (keep)
+                m.assign ({i, st.sp});
+            return true;
+        }
+        int const rc = fresh && ! sfx.rev.empty () ? back (keep) : epsilon_closure::SEARCH_MORE;
+        fresh = false;
+        if (epsilon_closure::SEARCH_MORE != rc) {
+            if (epsilon_closure::SEARCH_FAIL == rc)
+                st.sp = s.size () + 1;
+            return epsilon_closure::SEARCH_MATCH == rc;
+        }
+        if (epsilon_closure::SEARCH_MATCH != vm.search (st))
+            return false;
+        if (keep)
+            vm.captures (st.th0.cap, m);
+        return true;
+    }
+
+    std::size_t count (glushkov const* g);
+
+    // the reverse program runs from the end of s as LONGEST, so that its
+    // last match is at the leftmost start, and the scan stops when no
+    // thread lives. exec from the start gives the match and its captures.
+    // SEARCH_MORE leaves the search to the forward vm.
+    int back (bool const keep)
+    {
+        enum { START = 0 };
+        if (sfx.eol && s.find (L'\n', st.sp) != std::wstring::npos)
+            return epsilon_closure::SEARCH_MORE;
+        epsilon_closure rvm (sfx.rev, flag);
+        rvm.bind (s);
+        vmthread th{START, rvm.start (s.size ()), std::make_shared<counter_list> ()};
+        if (! rvm.advance (th, s.size (), -1, epsilon_closure::LONGEST))
+            return st.sp <= s.size () ? epsilon_closure::SEARCH_FAIL : epsilon_closure::SEARCH_MORE;
+        string_pointer const sp0 = rvm.capture (th.cap, 1);
+        vmthread th1{START, vm.start (sp0), std::make_shared<counter_list> ()};
+        if (sp0 < st.sp || ! vm.advance (th1, sp0, +1))
+            return epsilon_closure::SEARCH_MORE;
+        if (keep)
+            vm.captures (th1.cap, m);
+        st.sp = vm.capture (th1.cap, 1);
+        st.nonnull = sp0 == st.sp ? st.sp : std::wstring::npos;
+        return epsilon_closure::SEARCH_MATCH;
+    }
+};
+
+// the number of the rest of matches, where the vm does not capture groups.
+// when g tells where matches start, the search jumps over the positions
+// where none starts. the threads it would start there never match, and
+// those of the same instructions from the next start share their fate.
+// a pattern matching empty starts everywhere, so that g is not used.
+std::size_t vmiter::count (glushkov const* g)
+{
+    std::vector<std::uint64_t> at;
+    if (g && ! g->matches_empty ())
+        g->starts (s, st.sp, at);
+    vm.nocapture ();
+    std::size_t n = 0;
+    for (;; ++n) {
+        if (! at.empty ()) {
+            std::size_t k = st.sp / 64;
+            if (k >= at.size ())
+                break;
+            std::uint64_t w = at[k] & (~std::uint64_t (0) << (st.sp % 64));
+            while (! w && ++k < at.size ())
+                w = at[k];
+            if (! w)
+                break;
+            int j = 0;
+            while (! (w >> j & 1))
+                ++j;
+            st.sp = k * 64 + j;
+        }
+        if (! next (false))
+            break;
+    }
+    return n;
+}
+
+// work-stealing scheduler for wregex::exec_batch.
+// every worker owns a deque of the subject indices [lo, hi).
+// the owner takes grains from the front, and an idle worker steals
+// the back half of the other's deque.
+class workpool {
+public:
+    workpool (std::size_t const n, std::size_t const nworker, std::size_t const g)
+        : grain (g), que (nworker)
+    {
+        for (std::size_t i = 0; i < nworker; ++i) {
+            que[i].reset (new workque);
+            que[i]->lo = n * i / nworker;
+            que[i]->hi = n * (i + 1) / nworker;
+        }
+    }
+    bool take (std::size_t const id, std::size_t& lo, std::size_t& hi);
+private:
+    struct workque {
+        std::mutex mu;
+        std::size_t lo;
+        std::size_t hi;
+    };
+    std::size_t const grain;
+    std::vector<std::unique_ptr<workque>> que;
+};
+
+bool workpool::take (std::size_t const id, std::size_t& lo, std::size_t& hi)
+{
+    {
+        workque& own = *que[id];
+        std::lock_guard<std::mutex> lock (own.mu);
+        if (own.lo < own.hi) {
+            lo = own.lo;
+            hi = std::min (own.hi, own.lo + grain);
+            own.lo = hi;
+            return true;
+        }
+    }
+    for (std::size_t k = 1; k < que.size (); ++k) {
+        workque& victim = *que[(id + k) % que.size ()];
+        std::size_t steal_lo, steal_hi;
+        {
+            std::lock_guard<std::mutex> lock (victim.mu);
+            if (victim.lo >= victim.hi)
+                continue;
+            steal_hi = victim.hi;
+            steal_lo = victim.lo + (victim.hi - victim.lo) / 2;
+            victim.hi = steal_lo;
+        }
+        lo = steal_lo;
+        hi = std::min (steal_hi, steal_lo + grain);
+        workque& own = *que[id];
+        std::lock_guard<std::mutex> lock (own.mu);
+        own.lo = hi;
+        own.hi = steal_hi;
+        return true;
+    }
+    return false;
 }
 
 }//namespace wpike
 
-std::wstring::size_type wregex::exec (std::wstring const s,
+std::wstring::size_type const wregex::aborted;
+
+// exec of a literal pattern compares the needle at sp, ending by ep.
+static std::wstring::size_type execute (wpike::literal const& lit,
+    std::wstring const& s, wpike::capture_list& m, std::wstring::size_type const sp,
+    std::wstring::size_type const ep = std::wstring::npos)
+{
+    bool const x = sp <= ep && ep - sp >= lit.size () && lit.at (s, sp);
+    m.assign ({sp, x ? sp + lit.size () : sp});
+    return x ? m[1] : std::wstring::npos;
+}
+
+template<typename charT>
+static std::wstring::size_type execute (wpike::basic_epsilon_closure<charT>& vm,
+    std::basic_string<charT> const& s, wpike::capture_list& m,
+    std::wstring::size_type const sp, int const how = wpike::epsilon_closure::LEFTMOST)
+{
+    enum { START = 0 };
+    vm.bind (s);
+    wpike::vmthread th{
+        START,
+        vm.start (sp),
+        std::make_shared<wpike::counter_list> ()
+    };
+    bool x = vm.advance (th, sp, +1, how);
+    vm.captures (th.cap, m);
+    return x ? m[1] : std::wstring::npos;
+}
+
+// test from sp, or matches the entire s with FULL.
+template<typename charT>
+static bool execute_test (wpike::program const& e, wregex::flag_type const flag,
+    std::basic_string<charT> const& s, std::wstring::size_type const sp, int const how)
+{
+    enum { START = 0 };
+    wpike::basic_epsilon_closure<charT> vm (e, flag);
+    vm.bind (s);
+    bool const nocap = vm.nocapture ();
+    wpike::vmthread th{
+        START,
+        nocap ? std::wstring::npos : vm.start (sp),
+        std::make_shared<wpike::counter_list> ()
+    };
+    return vm.advance (th, sp, +1, wpike::epsilon_closure::EARLIEST | how);
+}
+
+static int match_how (wregex::match_flag_type const mf)
+{
+    return (wregex::match_earliest & mf) ? wpike::epsilon_closure::EARLIEST
+         : (wregex::match_longest & mf) ? wpike::epsilon_closure::LONGEST
+         : wpike::epsilon_closure::LEFTMOST;
+}
+
+std::wstring::size_type wregex::exec (std::wstring const& s,
     wpike::capture_list& m, std::wstring::size_type const sp) const
+{
+    if (! lit.empty ())
+        return execute (lit, s, m, sp);
+    wpike::epsilon_closure vm (e, flag);
+    return execute (vm, s, m, sp);
+}
+
+// exec with the match mode.
+//  match_default   leftmost-first, the match of the highest priority thread
+//  match_earliest  the shortest match, where any thread matches at first
+//  match_longest   leftmost-longest, the longest match of all threads
+std::wstring::size_type wregex::exec (std::wstring const& s,
+    wpike::capture_list& m, std::wstring::size_type const sp,
+    match_flag_type const mf) const
+{
+    if (! lit.empty ())
+        return execute (lit, s, m, sp);
+    wpike::glushkov const* const g = bits ? bits->get (e, flag) : nullptr;
+    if (g && ! g->captures () && (mf & (match_earliest | match_longest))) {
+        std::wstring::size_type const x = g->exec (s, sp, ! (mf & match_earliest));
+        m.assign ({sp, x == std::wstring::npos ? sp : x});
+        return x;
+    }
+    wpike::epsilon_closure vm (e, flag);
+    return execute (vm, s, m, sp, match_how (mf));
+}
+
+// exec on the code units of UTF-8, UTF-16, and UTF-32.
+// sp and captures are the offsets of code units.
+std::string::size_type wregex::exec (std::string const& s,
+    wpike::capture_list& m, std::string::size_type const sp,
+    match_flag_type const mf) const
+{
+    wpike::basic_epsilon_closure<char> vm (e, flag);
+    return execute (vm, s, m, sp, match_how (mf));
+}
+
+std::u16string::size_type wregex::exec (std::u16string const& s,
+    wpike::capture_list& m, std::u16string::size_type const sp,
+    match_flag_type const mf) const
+{
+    wpike::basic_epsilon_closure<char16_t> vm (e, flag);
+    return execute (vm, s, m, sp, match_how (mf));
+}
+
+std::u32string::size_type wregex::exec (std::u32string const& s,
+    wpike::capture_list& m, std::u32string::size_type const sp,
+    match_flag_type const mf) const
+{
+    wpike::basic_epsilon_closure<char32_t> vm (e, flag);
+    return execute (vm, s, m, sp, match_how (mf));
+}
+
+// exec_range in the window [sp, ep) of s as if it were the entire subject.
+// \A, \z, ^, $, and lookaheads stop at the bounds of the window, while
+// lookbehinds and \b look at the characters around it with match_context.
+template<typename charT>
+static std::wstring::size_type execute_window (wpike::program const& e,
+    wregex::flag_type const flag, std::basic_string<charT> const& s,
+    wpike::capture_list& m, std::wstring::size_type const sp,
+    std::wstring::size_type const ep, wregex::match_flag_type const mf)
 {
     enum { START = 0 };
-    wpike::epsilon_closure vm (e, s, flag);
+    wpike::basic_epsilon_closure<charT> vm (e, flag);
+    vm.bind (s);
+    vm.window (sp, ep, (wregex::match_context & mf) != 0);
     wpike::vmthread th{
         START,
-        std::make_shared<wpike::capture_list> (2, sp),
+        vm.start (sp),
         std::make_shared<wpike::counter_list> ()
     };
-    bool x = vm.advance (th, sp, +1);
-    m.clear ();
-    m.insert (m.begin (), th.cap->begin (), th.cap->end ());
+    bool const x = vm.advance (th, sp, +1, match_how (mf));
+    vm.captures (th.cap, m);
     return x ? m[1] : std::wstring::npos;
 }
 
+std::wstring::size_type wregex::exec_range (std::wstring const& s,
+    wpike::capture_list& m, std::wstring::size_type const sp,
+    std::wstring::size_type const ep, match_flag_type const mf) const
+{
+    if (! lit.empty ())
+        return execute (lit, s, m, sp, ep);
+    return execute_window (e, flag, s, m, sp, ep, mf);
+}
+
+std::string::size_type wregex::exec_range (std::string const& s,
+    wpike::capture_list& m, std::string::size_type const sp,
+    std::string::size_type const ep, match_flag_type const mf) const
+{
+    return execute_window (e, flag, s, m, sp, ep, mf);
+}
+
+std::u16string::size_type wregex::exec_range (std::u16string const& s,
+    wpike::capture_list& m, std::u16string::size_type const sp,
+    std::u16string::size_type const ep, match_flag_type const mf) const
+{
+    return execute_window (e, flag, s, m, sp, ep, mf);
+}
+
+std::u32string::size_type wregex::exec_range (std::u32string const& s,
+    wpike::capture_list& m, std::u32string::size_type const sp,
+    std::u32string::size_type const ep, match_flag_type const mf) const
+{
+    return execute_window (e, flag, s, m, sp, ep, mf);
+}
+
+// exec within the limit of steps and time.
+// returns wregex::aborted when the vm runs out of them, and m is cleared.
+std::wstring::size_type wregex::exec (std::wstring const& s,
+    wpike::capture_list& m, std::wstring::size_type const sp,
+    match_flag_type const mf, limit const& lim) const
+{
+    enum { START = 0 };
+    wpike::epsilon_closure vm (e, flag);
+    vm.bind (s);
+    wpike::vmthread th{
+        START,
+        vm.start (sp),
+        std::make_shared<wpike::counter_list> ()
+    };
+    int const how = match_how (mf);
+    bool x;
+    try {
+        vm.limit (lim);
+        x = vm.advance (th, sp, +1, how);
+    }
+    catch (wpike::vmabort const&) {
+        m.clear ();
+        return aborted;
+    }
+    vm.captures (th.cap, m);
+    return x ? m[1] : std::wstring::npos;
+}
+
+// whether the regex matches s from sp, without capture bookkeeping.
+bool wregex::test (std::wstring const& s, std::wstring::size_type const sp) const
+{
+    if (! lit.empty ())
+        return lit.at (s, sp);
+    if (wpike::glushkov const* const g = bits ? bits->get (e, flag) : nullptr)
+        return g->exec (s, sp, false) != std::wstring::npos;
+    return execute_test (e, flag, s, sp, 0);
+}
+
+bool wregex::test (std::string const& s, std::string::size_type const sp) const
+{
+    return execute_test (e, flag, s, sp, 0);
+}
+
+bool wregex::test (std::u16string const& s, std::u16string::size_type const sp) const
+{
+    return execute_test (e, flag, s, sp, 0);
+}
+
+bool wregex::test (std::u32string const& s, std::u32string::size_type const sp) const
+{
+    return execute_test (e, flag, s, sp, 0);
+}
+
+// whether the regex matches the entire s.
+bool wregex::matches (std::wstring const& s) const
+{
+    if (! lit.empty ())
+        return s.size () == lit.size () && lit.at (s, 0);
+    if (wpike::glushkov const* const g = bits ? bits->get (e, flag) : nullptr)
+        return g->matches (s);
+    return execute_test (e, flag, s, 0, wpike::epsilon_closure::FULL);
+}
+
+bool wregex::matches (std::string const& s) const
+{
+    return execute_test (e, flag, s, 0, wpike::epsilon_closure::FULL);
+}
+
+bool wregex::matches (std::u16string const& s) const
+{
+    return execute_test (e, flag, s, 0, wpike::epsilon_closure::FULL);
+}
+
+bool wregex::matches (std::u32string const& s) const
+{
+    return execute_test (e, flag, s, 0, wpike::epsilon_closure::FULL);
+}
+
+// match each subject from its beginning as exec (s[i], m[i], 0) does.
+// every worker thread has own vm scratch state reused over its subjects.
+std::vector<std::wstring::size_type> wregex::exec_batch (
+    std::wstring const* s, std::size_t const n,
+    std::vector<capture_list>& m, unsigned int nthread) const
+{
+    enum { MAXGRAIN = 64 };
+    std::vector<std::wstring::size_type> rc (n, std::wstring::npos);
+    m.resize (n);
+    if (n == 0)
+        return rc;
+    if (nthread == 0)
+        nthread = std::thread::hardware_concurrency ();
+    std::size_t nworker = std::max (1U, nthread);
+    nworker = std::min (nworker, n);
+    std::size_t const grain = std::max<std::size_t> (1,
+        std::min<std::size_t> (MAXGRAIN, n / (nworker * 8)));
+    wpike::workpool pool (n, nworker, grain);
+    std::vector<std::exception_ptr> err (nworker);
+    auto work = [&] (std::size_t const id) {
+        try {
+            wpike::epsilon_closure vm (e, flag);
+            std::size_t lo, hi;
+            while (pool.take (id, lo, hi))
+                for (std::size_t i = lo; i < hi; ++i)
+                    rc[i] = lit.empty () ? execute (vm, s[i], m[i], 0)
+                          : execute (lit, s[i], m[i], 0);
+        }
+        catch (...) {
+            err[id] = std::current_exception ();
+        }
+    };
+    std::vector<std::thread> worker;
+    for (std::size_t id = 1; id < nworker; ++id)
+        worker.emplace_back (work, id);
+    work (0);
+    for (auto& t : worker)
+        t.join ();
+    for (auto& x : err)
+        if (x)
+            std::rethrow_exception (x);
+    return rc;
+}
+
+std::vector<std::wstring::size_type> wregex::exec_batch (
+    std::vector<std::wstring> const& s,
+    std::vector<capture_list>& m, unsigned int nthread) const
+{
+    return exec_batch (s.data (), s.size (), m, nthread);
+}
+
+wregex::iterator::iterator () : vmi () {}
+
+wregex::iterator::iterator (wregex const& re, std::wstring const& s,
+    std::wstring::size_type const sp)
+    : vmi (std::make_shared<wpike::vmiter> (re.e, re.flag, re.lit, re.sfx, s, sp))
+{
+    if (! vmi->next ())
+        vmi.reset ();
+}
+
+wregex::iterator::reference wregex::iterator::operator* () const
+{
+    return vmi->m;
+}
+
+wregex::iterator::pointer wregex::iterator::operator-> () const
+{
+    return &vmi->m;
+}
+
+wregex::iterator& wregex::iterator::operator++ ()
+{
+    if (vmi && ! vmi->next ())
+        vmi.reset ();
+    return *this;
+}
+
+// call f for each match as wregex::iterator does,
+// and returns the number of matches.
+std::size_t wregex::find_all (std::wstring const& s,
+    std::function<void (capture_list const&)> f,
+    std::wstring::size_type const sp) const
+{
+    wpike::vmiter vmi (e, flag, lit, sfx, s, sp);
+    std::size_t n = 0;
+    for (; vmi.next (); ++n)
+        f (vmi.m);
+    return n;
+}
+
+// the number of matches find_all finds, without capture lists.
+// a literal pattern counts its needles.
+std::size_t wregex::count (std::wstring const& s, std::wstring::size_type const sp) const
+{
+    wpike::vmiter vmi (e, flag, lit, sfx, s, sp);
+    return vmi.count (bits ? bits->get (e, flag) : nullptr);
+}
+
+namespace wpike {
+
+// the replacement template is parsed into the list of pieces.
+// a piece is a literal slice of fmt when group < 0, or the captured
+// group ref[group], where ref lists the groups the template refers to.
+// a group past the last one of the pattern is empty.
+//
+//  $0 $&   entire matched slice
+//  $1..$9  captured group
+//  ${nn}   captured group
+//  $$      a dollar sign
+struct fmtpiece {
+    int group;
+    std::wstring::size_type pos;
+    std::wstring::size_type len;
+};
+
+static void parse_format (std::wstring const& fmt, int const ngroup,
+    std::vector<fmtpiece>& v, std::vector<int>& ref)
+{
+    std::wstring::size_type lit = 0;
+    for (std::wstring::size_type i = 0; i < fmt.size (); ) {
+        int g = -1;
+        std::wstring::size_type j = i + 1;
+        if (L'$' != fmt[i] || j >= fmt.size ()) {
+            ++i;
+            continue;
+        }
+        if (L'&' == fmt[j])
+            g = 0, ++j;
+        else if (c7toi (fmt[j]) < 10)
+            g = c7toi (fmt[j++]);
+        else if (L'{' == fmt[j]) {
+            std::wstring::size_type k = j + 1;
+            int x = 0;
+            for (; k < fmt.size () && k < j + 9 && c7toi (fmt[k]) < 10; ++k)
+                x = x * 10 + c7toi (fmt[k]);
+            if (k > j + 1 && k < fmt.size () && L'}' == fmt[k])
+                g = x, j = k + 1;
+        }
+        else if (L'$' == fmt[j]) {
+            // the first dollar sign closes the literal.
+            v.push_back (fmtpiece{-1, lit, i + 1 - lit});
+            lit = i = j + 1;
+            continue;
+        }
+        if (g < 0) {
+            ++i;
+            continue;
+        }
+        if (i > lit)
+            v.push_back (fmtpiece{-1, lit, i - lit});
+        if (g <= ngroup) {
+            int const k = std::find (ref.begin (), ref.end (), g) - ref.begin ();
+            if (k == static_cast<int> (ref.size ()))
+                ref.push_back (g);
+            v.push_back (fmtpiece{k, 0, 0});
+        }
+        lit = i = j;
+    }
+    if (fmt.size () > lit)
+        v.push_back (fmtpiece{-1, lit, fmt.size () - lit});
+}
+
+}//namespace wpike
+
+std::wstring wregex::replace (std::wstring const& s, std::wstring const& fmt) const
+{
+    std::wstring out;
+    replace (s, fmt, out);
+    return out;
+}
+
+// replace all matches in s with fmt, and append the result to out.
+// all matches are found at first with the captures of the groups
+// the template refers to, so that out is reserved once for the exact length.
+std::size_t wregex::replace (std::wstring const& s, std::wstring const& fmt,
+    std::wstring& out) const
+{
+    int ngroup = 0;
+    for (auto const& op : e)
+        if (wpike::SAVE == op.opcode)
+            ngroup = std::max (ngroup, op.x / 2);
+    std::vector<wpike::fmtpiece> piece;
+    std::vector<int> ref;
+    wpike::parse_format (fmt, ngroup, piece, ref);
+    // the match, and then the captures of ref.
+    std::size_t const w = 2 + ref.size () * 2;
+    std::vector<std::wstring::size_type> cap;
+    std::wstring::size_type len = s.size ();
+    wpike::vmiter vmi (e, flag, lit, sfx, s, 0);
+    std::size_t n = 0;
+    for (; vmi.next (); ++n) {
+        std::size_t const c = cap.size ();
+        cap.push_back (vmi.m[0]);
+        cap.push_back (vmi.m[1]);
+        for (int const g : ref)
+            for (std::size_t i = g * 2; i < g * 2 + 2u; ++i)
+                cap.push_back (i < vmi.m.size () ? vmi.m[i] : std::wstring::npos);
+        len -= vmi.m[1] - vmi.m[0];
+        for (auto const& x : piece)
+            if (x.group < 0)
+                len += x.len;
+            else if (cap[c + 2 + x.group * 2] != std::wstring::npos
+                    && cap[c + 3 + x.group * 2] != std::wstring::npos)
+                len += cap[c + 3 + x.group * 2] - cap[c + 2 + x.group * 2];
+    }
+    out.reserve (out.size () + len);
+    std::wstring::size_type pos = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        std::wstring::size_type const* m = &cap[i * w];
+        out.append (s, pos, m[0] - pos);
+        for (auto const& x : piece)
+            if (x.group < 0)
+                out.append (fmt, x.pos, x.len);
+            else if (m[2 + x.group * 2] != std::wstring::npos
+                    && m[3 + x.group * 2] != std::wstring::npos)
+                out.append (s, m[2 + x.group * 2], m[3 + x.group * 2] - m[2 + x.group * 2]);
+        pos = m[1];
+    }
+    out.append (s, pos, std::wstring::npos);
+    return n;
+}
+
+// replace all matches in s with what f appends to out.
+std::size_t wregex::replace (std::wstring const& s,
+    std::function<void (capture_list const&, std::wstring&)> f,
+    std::wstring& out) const
+{
+    out.reserve (out.size () + s.size ());
+    std::wstring::size_type pos = 0;
+    wpike::vmiter vmi (e, flag, lit, sfx, s, 0);
+    std::size_t n = 0;
+    for (; vmi.next (); ++n) {
+        out.append (s, pos, vmi.m[0] - pos);
+        f (vmi.m, out);
+        pos = vmi.m[1];
+    }
+    out.append (s, pos, std::wstring::npos);
+    return n;
+}
+
+// split s into the slices between matches, and append them to out.
+// returns the number of slices.
+std::size_t wregex::split (std::wstring const& s, std::vector<std::wstring>& out) const
+{
+    std::vector<std::wstring::size_type> cut;
+    wpike::vmiter vmi (e, flag, lit, sfx, s, 0);
+    while (vmi.next ()) {
+        cut.push_back (vmi.m[0]);
+        cut.push_back (vmi.m[1]);
+    }
+    out.reserve (out.size () + cut.size () / 2 + 1);
+    std::wstring::size_type pos = 0;
+    for (std::size_t i = 0; i < cut.size (); i += 2) {
+        out.emplace_back (s, pos, cut[i] - pos);
+        pos = cut[i + 1];
+    }
+    out.emplace_back (s, pos, std::wstring::npos);
+    return cut.size () / 2 + 1;
+}
+
+wregex_stream::wregex_stream (wregex const& re, std::size_t const history)
+    : vms (std::make_shared<wpike::vmstream> (re.e, re.flag, history)) {}
+
+// returns the number of matches decided by the chunk.
+std::size_t wregex_stream::feed (std::wstring const& chunk)
+{
+    vms->trim ();
+    vms->buf.append (chunk);
+    return vms->run ();
+}
+
+// tells the end of the text, and returns the number of the rest matches.
+std::size_t wregex_stream::finish ()
+{
+    vms->final = true;
+    return vms->run ();
+}
+
+bool wregex_stream::next (capture_list& m)
+{
+    if (vms->decided.empty ())
+        return false;
+    m = std::move (vms->decided.front ());
+    vms->decided.pop_front ();
+    return true;
+}
+
+std::wstring wregex_stream::substr (std::wstring::size_type const pos,
+    std::wstring::size_type const n) const
+{
+    return vms->buf.substr (pos - vms->base, n);
+}
+
 }//namespace t42
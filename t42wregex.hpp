@@ -3,6 +3,13 @@
 
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <memory>
+#include <iterator>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
 
 namespace t42 {
 namespace wpike {
@@ -31,6 +38,167 @@ typedef std::vector<instruction> program;
 typedef std::vector<std::wstring::size_type> capture_list;
 
 int c7toi (wchar_t const c);
+bool wchar_equal (wchar_t c0, wchar_t c1, int const flag);
+bool cclass (std::wstring const& span, wchar_t const c, int const flag);
+std::wstring widen (std::string const& s);
+std::wstring widen (std::u16string const& s);
+std::wstring widen (std::u32string const& s);
+bool markregions (program const& e, std::vector<std::vector<std::pair<int, int>>>& nestreg);
+
+struct vmstream;
+struct vmiter;
+
+// a pattern of characters only, searched by Boyer-Moore-Horspool.
+// with icase, the needle is folded to lower case, and so are the
+// characters of the subject it compares. the shift table is indexed by
+// the low 8 bits of a character, and keeps the smallest shift of them.
+class literal {
+public:
+    literal () : icase (false) {}
+    bool compile (program const& e, int const flag);
+    bool empty () const { return needle.empty (); }
+    std::size_t size () const { return needle.size (); }
+    bool at (std::wstring const& s, std::wstring::size_type const sp) const;
+    std::wstring::size_type find (std::wstring const& s, std::wstring::size_type const sp) const;
+private:
+    bool icase;
+    std::wstring needle;
+    std::size_t shift[256];
+    wchar_t fold (wchar_t const c) const;
+};
+
+// equivalence classes of characters for table-driven engines.
+// characters that no CHAR, CCLASS, or NCCLASS instruction distinguishes
+// share a class id, so that transitions are indexed by classes.
+// the line feed has a class of its own for BOL and EOL, and word
+// characters are distinguished when the program has \b or \B.
+class alphabet {
+public:
+    alphabet (program const& e, int const flag);
+    int size () const { return nclass; }
+    int classof (wchar_t const c) const
+    {
+        unsigned long const u = static_cast<unsigned long> (c);
+        if (u < 256)
+            return low[u];
+        return cls[std::upper_bound (from.begin (), from.end (), u) - from.begin () - 1];
+    }
+    // the smallest character of the class k.
+    wchar_t representative (int const k) const { return rep[k]; }
+private:
+    friend class dfa;
+    int nclass;
+    int low[256];
+    std::vector<unsigned long> from; // sorted starts of ranges from 256
+    std::vector<int> cls;
+    std::vector<wchar_t> rep;
+};
+
+// a deterministic automaton built ahead of time from a program,
+// for fixed patterns where the compile time is affordable.
+// a state is the list of vm threads in the order of their priorities,
+// cut off after MATCH, and transitions are indexed by alphabet classes.
+// exec finds the end of the leftmost-first match from sp as
+// wregex::exec does, without captures.
+// lookarounds, backreferences, assertions, and nested parentheses
+// patterns are not supported, and build () returns false with them.
+class dfa {
+public:
+    enum { DEAD = 0 };
+    dfa (program const& e, int const flag);
+    bool build (std::size_t const maxstate = 10000);
+    void minimize ();
+    std::size_t size () const { return accept.size (); }
+    std::wstring::size_type exec (std::wstring const& s, std::wstring::size_type const sp) const;
+    std::string emit_cpp (std::string const& name) const;
+private:
+    program e;
+    int flag;
+    alphabet abc;
+    int start;
+    std::vector<int> next;  // next[state * abc.size () + class]
+    std::vector<char> accept;
+};
+
+// a pattern whose matches all end at \z, or at $ on a subject without
+// line feeds, keeps its program reversed as lookbehinds are, so that
+// the search finds the leftmost start scanning back from the end.
+struct suffix {
+    program rev;
+    bool eol;
+    suffix () : eol (false) {}
+};
+
+// a bit-parallel Glushkov automaton of a program up to 64 positions,
+// which are its CHAR, ANY, CCLASS, and NCCLASS instructions.
+// the set of live threads is a word. a step takes the union of the
+// follow sets of the live positions by a table for each byte of the word,
+// and masks it with the positions accepting the character.
+// it tells where a match ends without priorities and captures, and
+// build () returns false with other than SAVE, JMP, SPLIT, and MATCH.
+// the reversed follow sets tell where matches start scanning back.
+class glushkov {
+public:
+    enum { MAXPOS = 64 };
+    static bool fits (program const& e);
+    bool build (program const& e, int const flag);
+    bool captures () const { return capturing; }
+    bool matches_empty () const { return nullable; }
+    // the end of the earliest or the longest match from sp, or npos.
+    std::wstring::size_type exec (std::wstring const& s, std::wstring::size_type const sp,
+        bool const longest) const;
+    bool matches (std::wstring const& s) const;
+    void starts (std::wstring const& s, std::wstring::size_type const sp,
+        std::vector<std::uint64_t>& at) const;
+private:
+    int flag;
+    bool capturing;
+    bool nullable;
+    std::uint64_t first;
+    std::uint64_t last;
+    std::vector<instruction> pos;
+    std::uint64_t low[256];
+    std::uint64_t follow[8][256];
+    std::uint64_t precede[8][256];
+    std::uint64_t accepts (wchar_t const c) const;
+    std::uint64_t mask (wchar_t const c) const
+    {
+        unsigned long const u = static_cast<unsigned long> (c);
+        return u < 256 ? low[u] : accepts (c);
+    }
+    std::uint64_t step (std::uint64_t d) const
+    {
+        std::uint64_t f = 0;
+        for (int k = 0; d; ++k, d >>= 8)
+            f |= follow[k][d & 0xff];
+        return f;
+    }
+    std::uint64_t stepback (std::uint64_t d) const
+    {
+        std::uint64_t f = 0;
+        for (int k = 0; d; ++k, d >>= 8)
+            f |= precede[k][d & 0xff];
+        return f;
+    }
+};
+
+// the automaton is built on the first use by any copy of the regex,
+// so that patterns only compiled or searched do not pay for its tables.
+class glushkov_once {
+public:
+    glushkov const* get (program const& e, int const flag)
+    {
+        std::call_once (once, [&] {
+            g.reset (new glushkov);
+            if (! g->build (e, flag))
+                g.reset ();
+        });
+        return g.get ();
+    }
+private:
+    std::once_flag once;
+    std::unique_ptr<glushkov> g;
+};
 
 }//namespace wpike
 
@@ -38,17 +206,130 @@ class regex_error {};
 
 class wregex {
 public:
-    enum { icase = 1 };
+    enum { icase = 1, nosubs = 2 };
+    enum { match_default = 0, match_earliest = 1, match_longest = 2, match_context = 4 };
+    enum { nest_depth = 32 };
     typedef int flag_type;
+    typedef int match_flag_type;
     typedef wpike::capture_list capture_list;
+    class iterator;
+    static std::wstring::size_type const aborted = std::wstring::npos - 1;
+
+    // steps is the budget of the number of instructions, 0 for unlimited.
+    struct limit {
+        unsigned long steps;
+        std::chrono::steady_clock::time_point deadline;
+        limit () : steps (0), deadline (std::chrono::steady_clock::time_point::max ()) {}
+    };
+
     wregex (std::wstring pat);
     wregex (std::wstring pat, flag_type f);
-    std::wstring::size_type exec (std::wstring const s,
+    wregex (std::wstring pat, flag_type f, std::vector<int> const& groups);
+    wregex (std::string const& pat, flag_type f = 0);
+    wregex (std::u16string const& pat, flag_type f = 0);
+    wregex (std::u32string const& pat, flag_type f = 0);
+    std::wstring::size_type exec (std::wstring const& s,
         capture_list& m, std::wstring::size_type const sp) const;
+    std::wstring::size_type exec (std::wstring const& s,
+        capture_list& m, std::wstring::size_type const sp,
+        match_flag_type const mf) const;
+    std::wstring::size_type exec (std::wstring const& s,
+        capture_list& m, std::wstring::size_type const sp,
+        match_flag_type const mf, limit const& lim) const;
+    std::string::size_type exec (std::string const& s,
+        capture_list& m, std::string::size_type const sp,
+        match_flag_type const mf = match_default) const;
+    std::u16string::size_type exec (std::u16string const& s,
+        capture_list& m, std::u16string::size_type const sp,
+        match_flag_type const mf = match_default) const;
+    std::u32string::size_type exec (std::u32string const& s,
+        capture_list& m, std::u32string::size_type const sp,
+        match_flag_type const mf = match_default) const;
+    std::wstring::size_type exec_range (std::wstring const& s,
+        capture_list& m, std::wstring::size_type const sp,
+        std::wstring::size_type const ep, match_flag_type const mf = match_default) const;
+    std::string::size_type exec_range (std::string const& s,
+        capture_list& m, std::string::size_type const sp,
+        std::string::size_type const ep, match_flag_type const mf = match_default) const;
+    std::u16string::size_type exec_range (std::u16string const& s,
+        capture_list& m, std::u16string::size_type const sp,
+        std::u16string::size_type const ep, match_flag_type const mf = match_default) const;
+    std::u32string::size_type exec_range (std::u32string const& s,
+        capture_list& m, std::u32string::size_type const sp,
+        std::u32string::size_type const ep, match_flag_type const mf = match_default) const;
+    bool test (std::wstring const& s, std::wstring::size_type const sp = 0) const;
+    bool test (std::string const& s, std::string::size_type const sp = 0) const;
+    bool test (std::u16string const& s, std::u16string::size_type const sp = 0) const;
+    bool test (std::u32string const& s, std::u32string::size_type const sp = 0) const;
+    bool matches (std::wstring const& s) const;
+    bool matches (std::string const& s) const;
+    bool matches (std::u16string const& s) const;
+    bool matches (std::u32string const& s) const;
+    std::vector<std::wstring::size_type> exec_batch (
+        std::wstring const* s, std::size_t const n,
+        std::vector<capture_list>& m, unsigned int nthread = 0) const;
+    std::vector<std::wstring::size_type> exec_batch (
+        std::vector<std::wstring> const& s,
+        std::vector<capture_list>& m, unsigned int nthread = 0) const;
+    std::size_t find_all (std::wstring const& s,
+        std::function<void (capture_list const&)> f,
+        std::wstring::size_type const sp = 0) const;
+    std::size_t count (std::wstring const& s, std::wstring::size_type const sp = 0) const;
+    std::wstring replace (std::wstring const& s, std::wstring const& fmt) const;
+    std::size_t replace (std::wstring const& s, std::wstring const& fmt,
+        std::wstring& out) const;
+    std::size_t replace (std::wstring const& s,
+        std::function<void (capture_list const&, std::wstring&)> f,
+        std::wstring& out) const;
+    std::size_t split (std::wstring const& s, std::vector<std::wstring>& out) const;
     wpike::program prog() { return e; }
+    flag_type flags () const { return flag; }
 private:
+    friend class wregex_stream;
+    friend class iterator;
     flag_type flag;
     wpike::program e;
+    wpike::literal lit;
+    std::shared_ptr<wpike::glushkov_once> bits;
+    wpike::suffix sfx;
+    void compile (std::wstring s, flag_type const f, std::vector<int> const* groups);
+};
+
+// iterate the leftmost-first matches without overlaps in s from sp.
+// after an empty match, the next match must not be empty at the same position.
+// both the regex and the subject must live until the end of the iteration.
+class wregex::iterator {
+public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef capture_list value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef capture_list const* pointer;
+    typedef capture_list const& reference;
+    iterator ();
+    iterator (wregex const& re, std::wstring const& s,
+        std::wstring::size_type const sp = 0);
+    reference operator* () const;
+    pointer operator-> () const;
+    iterator& operator++ ();
+    bool operator== (iterator const& x) const { return vmi == x.vmi; }
+    bool operator!= (iterator const& x) const { return vmi != x.vmi; }
+private:
+    std::shared_ptr<wpike::vmiter> vmi;
+};
+
+// search matches in the text given by successive chunks.
+// captures of matches are absolute positions from the beginning of the text.
+class wregex_stream {
+public:
+    typedef wpike::capture_list capture_list;
+    wregex_stream (wregex const& re, std::size_t const history = 64);
+    std::size_t feed (std::wstring const& chunk);
+    std::size_t finish ();
+    bool next (capture_list& m);
+    std::wstring substr (std::wstring::size_type const pos,
+        std::wstring::size_type const n) const;
+private:
+    std::shared_ptr<wpike::vmstream> vms;
 };
 
 }//namespace t42
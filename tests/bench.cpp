@@ -0,0 +1,190 @@
+// microbenchmarks of t42::wregex engines and std::wregex.
+//
+//      $ ./microbench [-t seconds] [-n maxsize] [-m maxstdsize] [case ...]
+//
+// each line of the output is tab separated fields
+//
+//      case engine size calls mbps p50_ns p90_ns p99_ns result
+//
+// size is the number of characters of the subject, and mbps is megabytes
+// of the subject in its own encoding per second. result is the match end,
+// or -1 for no match, to check engines agree with each other.
+// t42.test has 0 for a match.
+//
+// engines
+//      t42.exec    wregex::exec anchored at 0
+//      t42.test    wregex::test anchored at 0
+//      t42.utf8    wregex::exec on the UTF-8 subject
+//      t42.dfa     wpike::dfa::exec, when the pattern is supported
+//      t42.search  the first match of wregex::iterator
+//      std.exec    std::regex_search with match_continuous
+//      std.search  std::regex_search
+//
+// std::wregex recurses on the subject length, so that it runs only on
+// the subjects up to maxstdsize.
+#include <vector>
+#include <string>
+#include <regex>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <locale>
+#include <cstdlib>
+#include "t42wregex.hpp"
+
+struct benchcase {
+    char const* name;
+    wchar_t const* pattern;
+    std::wstring (* subject) (std::size_t n);
+};
+
+static std::wstring repeat (std::wstring const& unit, std::size_t const n, std::wstring const& tail)
+{
+    std::wstring s;
+    s.reserve (n);
+    while (s.size () + unit.size () + tail.size () <= n)
+        s += unit;
+    s += tail;
+    return s;
+}
+
+static std::wstring literal_subject (std::size_t n) { return repeat (L"abcdefgh ", n, L"needle"); }
+static std::wstring hex_subject (std::size_t n) { return repeat (L"0123456789abcdef", n, L"z"); }
+static std::wstring alt_subject (std::size_t n) { return repeat (L"foobarbazqux", n, L"!"); }
+static std::wstring capture_subject (std::size_t n) { return repeat (L"key=123;", n, L""); }
+static std::wstring lookaround_subject (std::size_t n) { return repeat (L"ab", n, L""); }
+static std::wstring counted_subject (std::size_t n) { return repeat (L"abc12 ", n, L""); }
+static std::wstring backref_subject (std::size_t n) { return repeat (L"aabbccdd", n, L""); }
+
+static benchcase const cases[] = {
+    {"literal", L"needle", literal_subject},
+    {"class", L"[0-9a-f]+", hex_subject},
+    {"alternation", L"(?:foo|bar|baz|qux)+", alt_subject},
+    {"capture", L"(?:(\\w+)=(\\d+);)+", capture_subject},
+    {"lookaround", L"(?:a(?=b)|(?<=a)b)+", lookaround_subject},
+    {"counted", L"(?:[a-z]{2,5}\\d{1,3} )+", counted_subject},
+    {"backref", L"(?:(\\w)\\1)+", backref_subject},
+};
+
+struct stats {
+    std::size_t calls;
+    double mbps;
+    long p50, p90, p99;
+    long result;
+};
+
+// call f until the time budget runs out, at least 3 times.
+static stats measure (std::function<long ()> f, std::size_t const bytes, double const budget)
+{
+    typedef std::chrono::steady_clock clock;
+    std::vector<long> ns;
+    stats st{};
+    clock::time_point const t0 = clock::now ();
+    double total = 0.0;
+    while (ns.size () < 3 || total < budget) {
+        clock::time_point const a = clock::now ();
+        st.result = f ();
+        clock::time_point const b = clock::now ();
+        ns.push_back (std::chrono::duration_cast<std::chrono::nanoseconds> (b - a).count ());
+        total = std::chrono::duration<double> (b - t0).count ();
+    }
+    double sum = 0.0;
+    for (long x : ns)
+        sum += x;
+    std::sort (ns.begin (), ns.end ());
+    st.calls = ns.size ();
+    st.mbps = sum > 0.0 ? bytes * ns.size () / (sum / 1e9) / 1e6 : 0.0;
+    st.p50 = ns[ns.size () * 50 / 100];
+    st.p90 = ns[ns.size () * 90 / 100];
+    st.p99 = ns[ns.size () * 99 / 100];
+    return st;
+}
+
+static void report (char const* name, char const* engine, std::size_t const n, stats const& st)
+{
+    std::cout << name << '\t' << engine << '\t' << n << '\t' << st.calls << '\t'
+        << st.mbps << '\t' << st.p50 << '\t' << st.p90 << '\t' << st.p99 << '\t'
+        << st.result << std::endl;
+}
+
+static long end_of (std::wstring::size_type const x)
+{
+    return x == std::wstring::npos ? -1 : static_cast<long> (x);
+}
+
+int main (int argc, char* argv[])
+{
+    std::locale::global (std::locale (""));
+    double budget = 0.2;
+    std::size_t maxsize = 1 << 20;
+    std::size_t maxstdsize = 1 << 12;
+    std::vector<std::string> only;
+    for (int i = 1; i < argc; ++i) {
+        std::string const a (argv[i]);
+        if (a == "-t" && i + 1 < argc)
+            budget = std::atof (argv[++i]);
+        else if (a == "-n" && i + 1 < argc)
+            maxsize = std::strtoul (argv[++i], nullptr, 10);
+        else if (a == "-m" && i + 1 < argc)
+            maxstdsize = std::strtoul (argv[++i], nullptr, 10);
+        else
+            only.push_back (a);
+    }
+    std::cout << "case\tengine\tsize\tcalls\tmbps\tp50_ns\tp90_ns\tp99_ns\tresult" << std::endl;
+    for (auto const& c : cases) {
+        if (! only.empty () && std::find (only.begin (), only.end (), c.name) == only.end ())
+            continue;
+        t42::wregex re (c.pattern);
+        t42::wpike::dfa d (re.prog (), re.flags ());
+        bool const dfa = d.build ();
+        if (dfa)
+            d.minimize ();
+        bool stdre = true;
+        std::wregex sre;
+        try {
+            sre.assign (c.pattern, std::regex_constants::ECMAScript);
+        }
+        catch (std::regex_error const&) {
+            stdre = false;
+        }
+        for (std::size_t n = 16; n <= maxsize; n *= 16) {
+            std::wstring const s = c.subject (n);
+            std::string const s8 (s.begin (), s.end ());
+            std::size_t const bytes = s.size () * sizeof (wchar_t);
+            t42::wregex::capture_list m;
+            report (c.name, "t42.exec", s.size (), measure ([&] {
+                return end_of (re.exec (s, m, 0));
+            }, bytes, budget));
+            report (c.name, "t42.test", s.size (), measure ([&] {
+                return re.test (s) ? 0L : -1L;
+            }, bytes, budget));
+            report (c.name, "t42.utf8", s.size (), measure ([&] {
+                return end_of (re.exec (s8, m, 0));
+            }, s8.size (), budget));
+            if (dfa)
+                report (c.name, "t42.dfa", s.size (), measure ([&] {
+                    return end_of (d.exec (s, 0));
+                }, bytes, budget));
+            report (c.name, "t42.search", s.size (), measure ([&] {
+                t42::wregex::iterator it (re, s), end;
+                return it == end ? -1L : static_cast<long> ((*it)[1]);
+            }, bytes, budget));
+            if (! stdre || s.size () > maxstdsize)
+                continue;
+            report (c.name, "std.exec", s.size (), measure ([&] {
+                std::wsmatch sm;
+                if (! std::regex_search (s, sm, sre, std::regex_constants::match_continuous))
+                    return -1L;
+                return static_cast<long> (sm.position (0) + sm.length (0));
+            }, bytes, budget));
+            report (c.name, "std.search", s.size (), measure ([&] {
+                std::wsmatch sm;
+                if (! std::regex_search (s, sm, sre))
+                    return -1L;
+                return static_cast<long> (sm.position (0) + sm.length (0));
+            }, bytes, budget));
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -415,6 +415,25 @@ struct testspec {
      L"char '}'\n"
      L"match\n"},
 
+    {L"q{2",
+     L"char 'q'\n"
+     L"char '{'\n"
+     L"char '2'\n"
+     L"match\n"},
+
+    {L"\\101\\x41\\x{41}\\u0041\\x4g\\u004",
+     L"char 'A'\n"
+     L"char 'A'\n"
+     L"char 'A'\n"
+     L"char 'A'\n"
+     L"char '\\x04'\n"
+     L"char 'g'\n"
+     L"char 'u'\n"
+     L"char '0'\n"
+     L"char '0'\n"
+     L"char '4'\n"
+     L"match\n"},
+
     {L"(a(b)c)d(e)",
      L"save 2\n"
      L"char 'a'\n"
@@ -487,7 +506,6 @@ struct testspec {
      L"match\n"},
 
     {L"\\1a",
-     L"reset %0\n"
      L"bkref 1,%0\n"
      L"char 'a'\n"
      L"match\n"},
@@ -498,7 +516,6 @@ struct testspec {
      L"match\n"},
 
     {L"\\91",
-     L"reset %0\n"
      L"bkref 9,%0\n"
      L"char '1'\n"
      L"match\n"},
@@ -904,6 +921,44 @@ struct testspec {
      L"match\n"
      L"jmp -22\n"
      L"match\n"},
+
+    {L"(?<=a(b|cd){2}e)f",
+     L"lkbehind 0,14\n"
+     L"char 'e'\n"
+     L"reset %0\n"
+     L"rep 2,2,%0\n"
+     L"split 0,8\n"
+     L"save 3\n"
+     L"split 0,2\n"
+     L"char 'b'\n"
+     L"jmp 2\n"
+     L"char 'd'\n"
+     L"char 'c'\n"
+     L"save 2\n"
+     L"jmp -10\n"
+     L"char 'a'\n"
+     L"match\n"
+     L"char 'f'\n"
+     L"match\n"},
+
+    {L"alpha|beta|alpine",
+     L"split 0,11\n"
+     L"char 'a'\n"
+     L"char 'l'\n"
+     L"char 'p'\n"
+     L"split 0,3\n"
+     L"char 'h'\n"
+     L"char 'a'\n"
+     L"jmp 3\n"
+     L"char 'i'\n"
+     L"char 'n'\n"
+     L"char 'e'\n"
+     L"jmp 4\n"
+     L"char 'b'\n"
+     L"char 'e'\n"
+     L"char 't'\n"
+     L"char 'a'\n"
+     L"match\n"},
 };
 
 int main (int argc, char* argv[])
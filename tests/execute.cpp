@@ -3,6 +3,7 @@
 #include <iostream>
 #include <locale>
 #include <utility>
+#include <algorithm>
 #include "t42wregex.hpp"
 #include "wtaptests.hpp"
 
@@ -685,12 +686,625 @@ void test30 (test::simple& ts)
     ts.ok (rc2 == 30, L"qr/(?*\\(\\*|\\*\\)|[^(*]|\\((?!\\*)|\\*(?!\\)))/ =~ \"(*c * (*o(**(m*)m))* (e**)nt*)\"_\"!\"");
 }
 
+void test31 (test::simple& ts)
+{
+    t42::wregex re (L"([a-z]+)=([0-9]*)");
+    std::vector<std::wstring> s;
+    for (int i = 0; i < 1000; ++i)
+        s.push_back (i % 3 ? L"key" + std::to_wstring (i % 7) + L"=" + std::to_wstring (i) : L"=?");
+    std::vector<t42::wregex::capture_list> mb;
+    std::vector<std::wstring::size_type> rc = re.exec_batch (s, mb, 4);
+    bool same = rc.size () == s.size () && mb.size () == s.size ();
+    for (std::size_t i = 0; same && i < s.size (); ++i) {
+        t42::wregex::capture_list m;
+        same = re.exec (s[i], m, 0) == rc[i] && m == mb[i];
+    }
+    ts.ok (same, L"exec_batch 4 threads == exec for 1000 subjects");
+
+    std::vector<std::wstring::size_type> rc1 = re.exec_batch (s, mb, 1);
+    ts.ok (rc1 == rc, L"exec_batch 1 thread == exec_batch 4 threads");
+
+    std::vector<std::wstring> s2;
+    std::vector<std::wstring::size_type> rc2 = re.exec_batch (s2, mb);
+    ts.ok (rc2.empty () && mb.empty (), L"exec_batch empty subjects");
+
+    t42::wregex re3 (L"\\w+=\\d+");
+    std::vector<std::wstring::size_type> rc3
+        = re3.exec_batch (std::vector<std::wstring> (4000, L"key=123"), mb, 8);
+    ts.ok (std::count (rc3.begin (), rc3.end (), 7) == 4000,
+        L"exec_batch 8 threads qr/\\w+=\\d+/ =~ \"key=123\"");
+}
+
+std::vector<t42::wregex::capture_list> stream_matches (t42::wregex const& re,
+    std::wstring const& s, std::size_t const chunk)
+{
+    t42::wregex_stream st (re, 4);
+    std::vector<t42::wregex::capture_list> v;
+    t42::wregex::capture_list m;
+    for (std::size_t i = 0; i < s.size (); i += chunk) {
+        st.feed (s.substr (i, chunk));
+        while (st.next (m))
+            v.push_back (m);
+    }
+    st.finish ();
+    while (st.next (m))
+        v.push_back (m);
+    return v;
+}
+
+void test32 (test::simple& ts)
+{
+    t42::wregex re1 (L"\\b([a-z]+)@([a-z]+)\\.com\\b");
+    std::wstring s1 (L"to: bob@example.com, eve@evil.comx, al@x.com");
+    std::vector<t42::wregex::capture_list> v1 = stream_matches (re1, s1, s1.size ());
+    ts.ok (v1.size () == 2 && v1[0][0] == 4 && v1[0][1] == 19 && v1[1][0] == 36 && v1[1][1] == 44,
+        L"stream qr/\\b([a-z]+)@([a-z]+)\\.com\\b/ in one chunk");
+    ts.ok (v1[0][2] == 4 && v1[0][3] == 7 && v1[1][4] == 39 && v1[1][5] == 40,
+        L"stream captures are absolute positions");
+    bool same = true;
+    for (std::size_t chunk = 1; chunk < 8; ++chunk)
+        same = same && stream_matches (re1, s1, chunk) == v1;
+    ts.ok (same, L"stream matches are independent from chunk sizes");
+
+    t42::wregex re2 (L"foo(?=bar)");
+    std::wstring s2 (L"foobaz foobar foo");
+    same = true;
+    for (std::size_t chunk = 1; chunk < 8; ++chunk) {
+        std::vector<t42::wregex::capture_list> v2 = stream_matches (re2, s2, chunk);
+        same = same && v2.size () == 1 && v2[0][0] == 7 && v2[0][1] == 10;
+    }
+    ts.ok (same, L"stream qr/foo(?=bar)/ lookahead over chunks");
+
+    t42::wregex re3 (L"x$");
+    std::wstring s3 (L"ax\nbxc\nx");
+    same = true;
+    for (std::size_t chunk = 1; chunk < 4; ++chunk) {
+        std::vector<t42::wregex::capture_list> v3 = stream_matches (re3, s3, chunk);
+        same = same && v3.size () == 2 && v3[0][0] == 1 && v3[1][0] == 7;
+    }
+    ts.ok (same, L"stream qr/x$/ end of lines over chunks");
+
+    t42::wregex re4 (L"a*");
+    std::vector<t42::wregex::capture_list> v4 = stream_matches (re4, L"baac", 1);
+    ts.ok (v4.size () == 4 && v4[0][1] == 0 && v4[1][0] == 1 && v4[1][1] == 3
+        && v4[2][0] == 3 && v4[2][1] == 3 && v4[3][0] == 4,
+        L"stream qr/a*/ empty matches advance");
+
+    t42::wregex_stream st (re1);
+    st.feed (L"mail bob@exam");
+    t42::wregex::capture_list m;
+    ts.ok (! st.next (m), L"stream undecided in the middle of a match");
+    st.feed (L"ple.com.");
+    ts.ok (st.next (m) && st.substr (m[2], m[3] - m[2]) == L"bob",
+        L"stream decided as soon as the match is decided");
+}
+
+void test33 (test::simple& ts)
+{
+    t42::wregex re1 (L"([a-z])([0-9]+)");
+    std::wstring s1 (L"a1 b22,c333!");
+    std::vector<std::wstring> v1;
+    for (t42::wregex::iterator it (re1, s1), end; it != end; ++it)
+        v1.push_back (s1.substr ((*it)[4], (*it)[5] - (*it)[4]));
+    ts.ok (v1 == std::vector<std::wstring>{L"1", L"22", L"333"},
+        L"iterator qr/([a-z])([0-9]+)/ over \"a1 b22,c333!\"");
+
+    std::vector<t42::wregex::capture_list> v2;
+    std::size_t n2 = re1.find_all (s1, [&] (t42::wregex::capture_list const& m) {
+        v2.push_back (m);
+    });
+    ts.ok (n2 == 3 && v2[1][0] == 3 && v2[1][1] == 6 && v2[2][0] == 7 && v2[2][1] == 11,
+        L"find_all qr/([a-z])([0-9]+)/ over \"a1 b22,c333!\"");
+
+    std::size_t n3 = re1.find_all (s1, [] (t42::wregex::capture_list const&) {}, 4);
+    ts.ok (n3 == 1, L"find_all qr/([a-z])([0-9]+)/ from 4");
+
+    t42::wregex re4 (L"x*");
+    std::wstring s4 (L"axxb");
+    std::vector<std::wstring::size_type> v4;
+    for (t42::wregex::iterator it (re4, s4), end; it != end; ++it) {
+        v4.push_back (it->at (0));
+        v4.push_back (it->at (1));
+    }
+    ts.ok (v4 == std::vector<std::wstring::size_type>{0, 0, 1, 3, 3, 3, 4, 4},
+        L"iterator qr/x*/ over \"axxb\" empty matches");
+
+    t42::wregex re5 (L"z");
+    ts.ok (t42::wregex::iterator (re5, s1) == t42::wregex::iterator (),
+        L"iterator qr/z/ without matches");
+}
+
+void test34 (test::simple& ts)
+{
+    t42::wregex re1 (L"([a-z]+)=([0-9]+)");
+    std::wstring s1 (L"a=1, bc=22; d=x");
+    ts.ok (re1.replace (s1, L"$2:$1") == L"1:a, 22:bc; d=x",
+        L"replace qr/([a-z]+)=([0-9]+)/ with \"$2:$1\"");
+    ts.ok (re1.replace (s1, L"[$&] $$${2}$9$") == L"[a=1] $1$, [bc=22] $22$; d=x",
+        L"replace qr/([a-z]+)=([0-9]+)/ with \"[$&] $$${2}$9$\"");
+
+    std::wstring out (L">");
+    std::size_t n = re1.replace (s1, L"<$0>", out);
+    ts.ok (n == 2 && out == L"><a=1>, <bc=22>; d=x", L"replace appends to the buffer");
+
+    t42::wregex re2 (L"[0-9]+");
+    std::wstring out2;
+    re2.replace (L"id 1234 pin 99", [] (t42::wregex::capture_list const& m, std::wstring& o) {
+        o.append (m[1] - m[0], L'*');
+    }, out2);
+    ts.ok (out2 == L"id **** pin **", L"replace with the callback for redaction");
+
+    t42::wregex re5 (L"a");
+    ts.ok (re5.replace (std::wstring (200, L'a'), L"${9999999}") == L""
+        && re1.replace (s1, L"$1${3}") == L"a, bc; d=x",
+        L"replace with a group past the last one as empty");
+
+    t42::wregex re3 (L" *, *");
+    std::vector<std::wstring> v3;
+    std::size_t n3 = re3.split (L"a , b,,c ,", v3);
+    ts.ok (n3 == 5 && v3 == std::vector<std::wstring>{L"a", L"b", L"", L"c", L""},
+        L"split qr/ *, */ \"a , b,,c ,\"");
+
+    t42::wregex re4 (L"x*");
+    std::vector<std::wstring> v4;
+    re4.split (L"axb", v4);
+    ts.ok (v4 == std::vector<std::wstring>{L"", L"a", L"", L"b", L""},
+        L"split qr/x*/ \"axb\" by empty matches");
+}
+
+void test35 (test::simple& ts)
+{
+    struct { std::wstring pat; std::wstring s; } spec[] = {
+        {L"a(.*)c", L"abcdcecf"},
+        {L"a(.+)c", L"acdxexf"},
+        {L".*\\b(abc\\B..)", L"Aabcde abc abcfg hi"},
+        {L"(?:[A-Z][a-z]+){2,4}", L"FrontPage"},
+        {L"<([A-Z]+)>.*?</\\1>", L"<EM>emphasis</EM>"},
+        {L"<([A-Z]+)>.*?</\\1>", L"<EM>emphasis</EN>"},
+        {L"(?<=a)b", L"b"},
+        {L"x(?=y)", L"xy"},
+        {L"x(?!y)", L"xy"},
+    };
+    bool same = true;
+    for (auto const& x : spec) {
+        t42::wregex re (x.pat);
+        t42::wregex::capture_list m;
+        same = same && re.test (x.s) == (re.exec (x.s, m, 0) != std::wstring::npos);
+    }
+    ts.ok (same, L"test agrees with exec");
+
+    t42::wregex re1 (L"(b)c");
+    ts.ok (re1.test (L"abc", 1) && ! re1.test (L"abc", 0), L"test qr/(b)c/ from sp");
+
+    t42::wregex re2 (L"a|ab");
+    ts.ok (re2.matches (L"ab") && re2.matches (L"a") && ! re2.matches (L"abc"),
+        L"matches qr/a|ab/ the entire subject");
+
+    t42::wregex re3 (L"([a-z]+)-\\1");
+    ts.ok (re3.matches (L"abc-abc") && ! re3.matches (L"abc-ab"),
+        L"matches qr/([a-z]+)-\\1/ with captures for the backref");
+}
+
+void test36 (test::simple& ts)
+{
+    t42::wregex::capture_list m;
+    t42::wregex re1 (L"(a|ab)(c|bcd)(d*)");
+    std::wstring s1 (L"abcd");
+    ts.ok (re1.exec (s1, m, 0, t42::wregex::match_default) == 4 && m[3] == 1,
+        L"qr/(a|ab)(c|bcd)(d*)/ =~ \"abcd\" leftmost-first");
+    ts.ok (re1.exec (s1, m, 0, t42::wregex::match_earliest) == 3 && m[3] == 2,
+        L"qr/(a|ab)(c|bcd)(d*)/ =~ \"abc\"_\"d\" earliest");
+    ts.ok (re1.exec (s1, m, 0, t42::wregex::match_longest) == 4,
+        L"qr/(a|ab)(c|bcd)(d*)/ =~ \"abcd\" longest");
+
+    t42::wregex re2 (L"a|ab|abc?");
+    std::wstring s2 (L"abcd");
+    ts.ok (re2.exec (s2, m, 0, t42::wregex::match_default) == 1,
+        L"qr/a|ab|abc?/ =~ \"a\"_\"bcd\" leftmost-first");
+    ts.ok (re2.exec (s2, m, 0, t42::wregex::match_longest) == 3,
+        L"qr/a|ab|abc?/ =~ \"abc\"_\"d\" longest");
+
+    t42::wregex re3 (L"x*");
+    ts.ok (re3.exec (L"xxx", m, 0, t42::wregex::match_earliest) == 0,
+        L"qr/x*/ =~ _\"xxx\" earliest");
+
+    t42::wregex re4 (L"(a+?)");
+    ts.ok (re4.exec (L"aaab", m, 0, t42::wregex::match_longest) == 3 && m[3] == 3,
+        L"qr/(a+?)/ =~ \"aaa\"_\"b\" longest");
+
+    t42::wregex re5 (L"x(y|z)");
+    ts.ok (re5.exec (L"xw", m, 0, t42::wregex::match_longest) == std::wstring::npos,
+        L"qr/x(y|z)/ !~ \"xw\" longest");
+}
+
+void test37 (test::simple& ts)
+{
+    t42::wregex::capture_list m;
+    t42::wregex re1 (L"(?:a|aa)*b");
+    std::wstring s1 (1000, L'a');
+    t42::wregex::limit lim;
+    ts.ok (re1.exec (s1, m, 0, t42::wregex::match_default, lim) == std::wstring::npos,
+        L"qr/(?:a|aa)*b/ !~ \"a\" x 1000 unlimited");
+
+    lim.steps = 100;
+    ts.ok (re1.exec (s1, m, 0, t42::wregex::match_default, lim) == t42::wregex::aborted
+        && m.empty (), L"qr/(?:a|aa)*b/ aborted by the step budget");
+    ts.ok (re1.exec (L"aab", m, 0, t42::wregex::match_default, lim) == 3,
+        L"qr/(?:a|aa)*b/ =~ \"aab\"_ within the step budget");
+
+    lim.steps = 0;
+    lim.deadline = std::chrono::steady_clock::now () - std::chrono::seconds (1);
+    ts.ok (re1.exec (s1, m, 0, t42::wregex::match_default, lim) == t42::wregex::aborted,
+        L"qr/(?:a|aa)*b/ aborted by the deadline");
+
+    lim.deadline = std::chrono::steady_clock::now () + std::chrono::hours (1);
+    ts.ok (re1.exec (s1 + L"b", m, 0, t42::wregex::match_default, lim) == 1001,
+        L"qr/(?:a|aa)*b/ =~ \"a\" x 1000 \"b\"_ before the deadline");
+}
+
+void test38 (test::simple& ts)
+{
+    t42::wregex::capture_list m;
+    t42::wregex re1 (L"(?*\\(|\\)|.)x");
+    ts.ok (re1.exec (L"(()x", m, 0) == 4, L"qr/(?*\\(|\\)|.)x/ =~ \"(()x\"_ threads at each depth");
+
+    t42::wregex re2 (L"(?*<|>|[^<>])");
+    std::wstring s2 = std::wstring (t42::wregex::nest_depth, L'<')
+        + std::wstring (t42::wregex::nest_depth, L'>');
+    ts.ok (re2.exec (s2, m, 0) == s2.size (), L"qr/(?*<|>|[^<>])/ =~ nest_depth");
+    std::wstring s3 = L"<" + s2 + L">";
+    ts.ok (re2.exec (s3, m, 0) == std::wstring::npos, L"qr/(?*<|>|[^<>])/ !~ nest_depth + 1");
+
+    t42::wregex re4 (L"(?*a*|b|c)");
+    ts.ok (re4.exec (L"acb", m, 0) == 3, L"qr/(?*a*|b|c)/ =~ \"acb\"_ with nullable left token");
+}
+
+void test39 (test::simple& ts)
+{
+    t42::wregex::capture_list m;
+    t42::wregex re1 (L"([a-z]+)\\1");
+    ts.ok (re1.exec (L"abcabc", m, 0) == 6 && m[3] == 3,
+        L"qr/([a-z]+)\\1/ =~ \"abcabc\"_");
+
+    t42::wregex re2 (L".*?\\b(\\w+)\\s+\\1\\b");
+    std::wstring s2 (L"this is is a test test.");
+    ts.ok (re2.exec (s2, m, 0) == 10 && s2.substr (m[2], m[3] - m[2]) == L"is",
+        L"qr/.*?\\b(\\w+)\\s+\\1\\b/ =~ \"this is is\"_\" a test test.\"");
+
+    t42::wregex re3 (L"(\\w+) \\1", t42::wregex::icase);
+    ts.ok (re3.exec (L"Hello hELLO!", m, 0) == 11, L"qr/(\\w+) \\1/i =~ \"Hello hELLO\"_\"!\"");
+
+    t42::wregex re4 (L"(ab)+c(?<=\\1c)");
+    ts.ok (re4.exec (L"ababc", m, 0) == 5, L"qr/(ab)+c(?<=\\1c)/ =~ \"ababc\"_ lookbehind");
+
+    t42::wregex re5 (L"(\\w+)=\\1");
+    std::vector<t42::wregex::capture_list> v5 = stream_matches (re5, L"x abcd=abcd abc=abd", 2);
+    ts.ok (v5.size () == 1 && v5[0][0] == 2 && v5[0][1] == 11,
+        L"stream qr/(\\w+)=\\1/ backref over chunks");
+}
+
+void test40 (test::simple& ts)
+{
+    t42::wregex::capture_list m;
+    t42::wregex re1 (L"caf\u00e9 (.)");
+    std::string s1 (u8"un caf\u00e9 \u00e0 x");
+    ts.ok (re1.exec (s1, m, 3) == 11 && m[2] == 9 && m[3] == 11,
+        L"utf-8 qr/caf\u00e9 (.)/ captures by bytes");
+
+    t42::wregex re2 (L"(?<=\u00e9)x");
+    ts.ok (re2.test (std::string (u8"\u00e9x"), 2), L"utf-8 lookbehind decodes backward");
+
+    t42::wregex re3 (std::string (u8"[\u00e0-\u00ff]+"));
+    ts.ok (re3.matches (std::string (u8"\u00e0\u00e9\u00ff")), L"utf-8 pattern qr/[\u00e0-\u00ff]+/");
+
+    t42::wregex re4 (L"a.b");
+    ts.ok (re4.exec (std::u16string (u"a\U0001F600b"), m, 0) == 4,
+        L"utf-16 qr/a.b/ steps over a surrogate pair");
+    ts.ok (re4.exec (std::string ("a\xff" "b"), m, 0) == 3, L"utf-8 ill-formed byte is a character");
+
+    t42::wregex re5 (L"(\\w)\\1", t42::wregex::icase);
+    ts.ok (re5.test (std::u32string (U"xAa"), 1), L"utf-32 qr/(\\w)\\1/i");
+
+    t42::wregex re6 (L"(a\u00e9)\\1", t42::wregex::icase);
+    ts.ok (re6.exec (std::string (u8"a\u00e9A\u00e9"), m, 0) == 6, L"utf-8 qr/(a\u00e9)\\1/i");
+
+    t42::wregex re7 (L"(?<=\U0001F600)b");
+    ts.ok (re7.test (std::u16string (u"\U0001F600b"), 2), L"utf-16 lookbehind over a surrogate pair");
+}
+
+void test41 (test::simple& ts)
+{
+    t42::wregex re1 (L"[a-c]x|\\d");
+    t42::wpike::alphabet a1 (re1.prog (), re1.flags ());
+    ts.ok (a1.size () == 5, L"alphabet qr/[a-c]x|\\d/ has 5 classes");
+    ts.ok (a1.classof (L'a') == a1.classof (L'c') && a1.classof (L'a') != a1.classof (L'x'),
+        L"alphabet [a-c] is a class");
+    ts.ok (a1.classof (L'0') == a1.classof (L'9') && a1.classof (L'd') == a1.classof (L'\u3000'),
+        L"alphabet \\d is a class");
+    ts.ok (a1.classof (L'\n') != a1.classof (L'd'), L"alphabet line feed is a class");
+
+    t42::wregex re2 (L"k", t42::wregex::icase);
+    t42::wpike::alphabet a2 (re2.prog (), re2.flags ());
+    ts.ok (a2.classof (L'K') == a2.classof (L'k') && a2.classof (L'K') != a2.classof (L'j'),
+        L"alphabet qr/k/i folds case");
+
+    t42::wregex re3 (L"[\u03b1-\u03c9]z");
+    t42::wpike::alphabet a3 (re3.prog (), re3.flags ());
+    ts.ok (a3.size () == 4 && a3.classof (L'\u03b2') == a3.classof (L'\u03b1')
+        && a3.representative (a3.classof (L'\u03c9')) == L'\u03b1',
+        L"alphabet qr/[\u03b1-\u03c9]z/ from boundaries");
+}
+
+void test42 (test::simple& ts)
+{
+    static wchar_t const* const pat[] = {
+        L"a(b|c)*d", L"(a|ab)(c|bcd)", L"(ab){2,}c", L"[^ab]+a|b.c", L"a|ab"};
+    static wchar_t const* const subject[] = {
+        L"abcbd", L"abcd", L"ababab", L"ababc", L"xya", L"bxc", L"ab", L"d"};
+    for (auto p : pat) {
+        t42::wregex re (p);
+        t42::wpike::dfa d (re.prog (), re.flags ());
+        bool same = d.build ();
+        std::size_t const n0 = d.size ();
+        d.minimize ();
+        t42::wregex::capture_list m;
+        for (auto s : subject)
+            for (std::size_t sp = 0; sp < 3; ++sp)
+                same = same && re.exec (s, m, sp) == d.exec (s, sp);
+        ts.ok (same && d.size () <= n0, std::wstring (L"dfa qr/") + p + L"/ as exec");
+    }
+
+    t42::wregex re6 (L"(ab){2,}c", t42::wregex::icase);
+    t42::wpike::dfa d6 (re6.prog (), re6.flags ());
+    ts.ok (d6.build () && (d6.minimize (), d6.exec (L"AbaBC", 0) == 5), L"dfa qr/(ab){2,}c/i");
+
+    t42::wregex re7 (L"a(?=b)");
+    t42::wpike::dfa d7 (re7.prog (), re7.flags ());
+    ts.ok (! d7.build (), L"dfa qr/a(?=b)/ not supported");
+
+    t42::wregex re8 (L"[x-z]+\\d");
+    t42::wpike::dfa d8 (re8.prog (), re8.flags ());
+    d8.build ();
+    d8.minimize ();
+    ts.ok (d8.emit_cpp ("rule8").find ("std::wstring::size_type rule8 (") != std::string::npos,
+        L"dfa emit_cpp");
+}
+
+void test43 (test::simple& ts)
+{
+    t42::wregex::capture_list m;
+    std::wstring s1 (1000, L'7');
+    s1 += L"beef,x";
+    t42::wregex re1 (L"([0-9a-f]+),");
+    ts.ok (re1.exec (s1, m, 0) == 1005 && m[3] == 1004, L"qr/([0-9a-f]+),/ over a long run");
+
+    t42::wregex re2 (L"[^,]*,[^,]*");
+    ts.ok (re2.exec (s1, m, 0) == 1006, L"qr/[^,]*,[^,]*/ over a long run");
+
+    t42::wregex re3 (L"\\s*\\w+?\\d", t42::wregex::icase);
+    std::wstring s3 (300, L' ');
+    s3 += L"AB12";
+    ts.ok (re3.exec (s3, m, 0) == 303, L"qr/\\s*\\w+?\\d/i over a long run");
+
+    std::vector<std::wstring> v4;
+    t42::wregex (L"[a-z]+").split (L"ab12cde345f", v4);
+    ts.ok (v4.size () == 4 && v4[2] == L"345", L"split by qr/[a-z]+/ with runs");
+
+    t42::wregex::limit lim;
+    lim.steps = 500;
+    ts.ok (re1.exec (s1, m, 0, t42::wregex::match_default, lim) == t42::wregex::aborted,
+        L"skipped steps are charged to the budget");
+
+    std::vector<t42::wregex::capture_list> v6 = stream_matches (re1, s1, 7);
+    ts.ok (v6.size () == 1 && v6[0][0] == 0 && v6[0][1] == 1005, L"stream qr/([0-9a-f]+),/ runs over chunks");
+}
+
+void test44 (test::simple& ts)
+{
+    t42::wregex::capture_list m;
+    t42::wregex re1 (L"a{1,3}");
+    ts.ok (re1.exec (L"aaaa", m, 0) == 3, L"qr/a{1,3}/ =~ \"aaaa\" takes 3");
+
+    t42::wregex re2 (L"\\w+\\w{2}");
+    ts.ok (re2.exec (L"cbc", m, 0) == 3, L"qr/\\w+\\w{2}/ keeps threads of each count");
+
+    t42::wregex re3 (L"(a?){2}b");
+    ts.ok (re3.exec (L"b", m, 0) == 1 && m[2] == 0 && m[3] == 0, L"qr/(a?){2}b/ iterates empty");
+
+    t42::wregex re4 (L"(?:){2}");
+    t42::wpike::dfa d4 (re4.prog (), re4.flags ());
+    ts.ok (d4.build () && d4.exec (L"x", 0) == 0, L"dfa qr/(?:){2}/ iterates empty");
+
+    t42::wregex re5 (L"(?=\\d?(\\D)|x?)");
+    std::vector<t42::wregex::capture_list> v5 = stream_matches (re5, L"A b", 1);
+    ts.ok (v5.size () == 4 && v5[1][2] == 1 && v5[1][3] == 2,
+        L"stream lookahead waits for captures over chunks");
+}
+
+void test45 (test::simple& ts)
+{
+    t42::wregex::capture_list m;
+    t42::wregex re1 (L"alpha|beta|alphabet");
+    ts.ok (re1.exec (L"alphabet", m, 0) == 5, L"qr/alpha|beta|alphabet/ keeps the priority in the trie");
+
+    t42::wregex re2 (L"(?:Ab|b|ab)c", t42::wregex::icase);
+    ts.ok (re2.exec (L"abc", m, 0) == 3, L"qr/(?:Ab|b|ab)c/i folds the leads of the trie");
+
+    t42::wregex re3 (L"b|.|ax");
+    ts.ok (re3.exec (L"ax", m, 0) == 1, L"qr/b|.|ax/ does not move over an any");
+
+    t42::wregex re4 (L"(a)b|a(c)");
+    ts.ok (re4.exec (L"ac", m, 0) == 2 && m[2] == -1 && m[4] == 1,
+        L"qr/(a)b|a(c)/ keeps the groups out of the trie");
+
+    t42::wregex re5 (L".*(?<=c(x)|a.|c(..))d");
+    ts.ok (re5.exec (L"cabd", m, 0) == 4 && m.size () == 2,
+        L"qr/.*(?<=c(x)|a.|c(..))d/ keeps the order of alternatives in a lookbehind");
+}
+
+void test46 (test::simple& ts)
+{
+    t42::wregex::capture_list m;
+    t42::wregex re1 (L"needle");
+    ts.ok (re1.exec (L"a needle", m, 2) == 8 && m.size () == 2 && m[0] == 2,
+        L"literal qr/needle/ exec at 2");
+    ts.ok (re1.exec (L"a needle", m, 0) == std::wstring::npos && m[0] == 0 && m[1] == 0,
+        L"literal qr/needle/ exec fails at 0");
+    ts.ok (re1.matches (L"needle") && ! re1.matches (L"needles"),
+        L"literal qr/needle/ matches entire");
+
+    t42::wregex re2 (L"NeEdle", t42::wregex::icase);
+    std::vector<std::wstring::size_type> v2;
+    re2.find_all (L"needle NEEDLE nEeDlEneedle", [&] (t42::wregex::capture_list const& x) {
+        v2.push_back (x[0]);
+    });
+    ts.ok (v2 == std::vector<std::wstring::size_type>{0, 7, 14, 20},
+        L"literal qr/NeEdle/i finds folded needles");
+
+    t42::wregex re3 (L"a\\x{161}");
+    t42::wregex::iterator it3 (re3, L"\u0161aa\u0161"), end3;
+    ts.ok (it3 != end3 && (*it3)[0] == 2, L"literal shifts by the low bits of characters");
+}
+
+void test47 (test::simple& ts)
+{
+    t42::wregex::capture_list m;
+    t42::wregex re1 (L"(?:ab|a)*c");
+    ts.ok (re1.test (L"ababac") && re1.matches (L"ababac") && ! re1.matches (L"ababa"),
+        L"bit-parallel qr/(?:ab|a)*c/ test and matches");
+
+    t42::wregex re2 (L"a+");
+    ts.ok (re2.exec (L"aaab", m, 0, t42::wregex::match_earliest) == 1
+        && re2.exec (L"aaab", m, 0, t42::wregex::match_longest) == 3 && m[0] == 0 && m[1] == 3,
+        L"bit-parallel qr/a+/ earliest and longest");
+
+    t42::wregex re3 (L"[a-c]+x\\x{161}", t42::wregex::icase);
+    ts.ok (re3.matches (L"ABcX\u0161") && ! re3.matches (L"ABdX\u0161"),
+        L"bit-parallel qr/[a-c]+x\\x{161}/i folds characters");
+
+    std::wstring p4, s4;
+    for (int i = 0; i < 40; ++i)
+        p4 += L"a.", s4 += L"ab";
+    t42::wregex re4 (p4);
+    ts.ok (re4.matches (s4) && ! re4.test (s4.substr (1)), L"qr/(a.){40}/ over 64 positions runs on the vm");
+
+    t42::wregex re5 (L"(a)|b");
+    ts.ok (re5.exec (L"a", m, 0, t42::wregex::match_longest) == 1 && m[2] == 0 && m[3] == 1,
+        L"qr/(a)|b/ longest keeps captures on the vm");
+}
+
+void test48 (test::simple& ts)
+{
+    t42::wregex re1 (L"(\\w+)\\.(\\w+)\\z");
+    std::wstring const s1 (L"a.b c.tar");
+    t42::wregex::iterator it1 (re1, s1), end;
+    ts.ok (it1 != end && *it1 == t42::wregex::capture_list{4, 9, 4, 5, 6, 9},
+        L"qr/(\\w+)\\.(\\w+)\\z/ searches backward from the end");
+
+    t42::wregex re2 (L"x*\\z");
+    ts.ok (re2.find_all (L"ab", [] (t42::wregex::capture_list const&) {}) == 1,
+        L"qr/x*\\z/ finds the empty match at the end once");
+
+    t42::wregex re3 (L"b$");
+    std::wstring const s3 (L"ab\nab");
+    t42::wregex::iterator it3 (re3, s3);
+    ts.ok (it3 != end && (*it3)[0] == 1, L"qr/b$/ searches forward over line feeds");
+
+    t42::wregex re4 (L"(?<=a)a\\z");
+    std::wstring const s4 (L"aaa"), s5 (L"a");
+    t42::wregex::iterator it4 (re4, s4, 2), it5 (re4, s5);
+    ts.ok (it4 != end && (*it4)[0] == 2 && it5 == end, L"qr/(?<=a)a\\z/ from sp 2");
+}
+
+void test49 (test::simple& ts)
+{
+    std::wstring const s (L"abcab");
+    t42::wregex::capture_list m;
+    t42::wregex re1 (L"(a)(b)(c)", 0, std::vector<int>{2});
+    re1.exec (s, m, 0);
+    ts.ok (m == t42::wregex::capture_list{0, 3, std::wstring::npos, std::wstring::npos, 1, 2},
+        L"qr/(a)(b)(c)/ captures only $2");
+
+    t42::wregex re2 (L"(a)+b", t42::wregex::nosubs);
+    ts.ok (re2.exec (s, m, 0) == 2 && m.size () == 2, L"qr/(a)+b/ with nosubs captures $0");
+
+    t42::wregex re3 (L"(a)(b)\\1", t42::wregex::nosubs);
+    std::wstring const s3 (L"aba");
+    ts.ok (re3.exec (s3, m, 0) == 3 && m.size () == 4 && m[2] == 0,
+        L"qr/(a)(b)\\1/ with nosubs keeps $1 for the backreference");
+
+    t42::wregex re4 (L"(a)(b)", t42::wregex::nosubs);
+    ts.ok (re4.prog ().size () == 3, L"qr/(a)(b)/ with nosubs emits no SAVE of groups");
+}
+
+void test50 (test::simple& ts)
+{
+    std::wstring pat, rec;
+    for (int i = 0; i < 20; ++i) {
+        pat += i ? L",(\\w*)" : L"(\\w*)";
+        rec += (i ? L"," : L"") + std::wstring (1, L'a' + i);
+    }
+    t42::wregex re1 (pat);
+    t42::wregex::capture_list m;
+    ts.ok (re1.exec (rec, m, 0) == rec.size () && m.size () == 42 && m[40] == 38 && m[41] == 39,
+        L"qr/(\\w*),..,(\\w*)/ captures 20 groups");
+
+    // chains of the capture log are collapsed and compacted on the way.
+    std::wstring s2 (L"x");
+    s2.append (20000, L'a');
+    s2 += L"bx";
+    t42::wregex re2 (L"(x)(?:(a)|b)*\\1");
+    ts.ok (re2.exec (s2, m, 0) == s2.size () && m[2] == 0 && m[4] == 20000 && m[5] == 20001,
+        L"qr/(x)(?:(a)|b)*\\1/ over 20000 iterations");
+}
+
+void test51 (test::simple& ts)
+{
+    t42::wregex::capture_list m;
+    std::wstring const s1 (L"xx,ab,yy");
+    t42::wregex re1 (L"\\A(\\w+)$");
+    ts.ok (re1.exec_range (s1, m, 3, 5, t42::wregex::match_default) == 5 && m[2] == 3,
+        L"qr/\\A(\\w+)$/ in the window [3, 5)");
+
+    std::wstring const s2 (L"xabx");
+    t42::wregex re2 (L"\\bab\\b");
+    ts.ok (re2.exec_range (s2, m, 1, 3, t42::wregex::match_default) == 3
+        && re2.exec_range (s2, m, 1, 3, t42::wregex::match_context) == std::wstring::npos,
+        L"qr/\\bab\\b/ looks at the context with match_context");
+
+    t42::wregex re3 (L"(?<=x)ab");
+    ts.ok (re3.exec_range (s2, m, 1, 3, t42::wregex::match_default) == std::wstring::npos
+        && re3.exec_range (s2, m, 1, 3, t42::wregex::match_context) == 3,
+        L"qr/(?<=x)ab/ looks behind the window with match_context");
+
+    std::string const s4 ("\xc3\xa9t\xc3\xa9,x");
+    t42::wregex re4 (L"^[^,]+$");
+    ts.ok (re4.exec_range (s4, m, 0, 5, t42::wregex::match_default) == 5,
+        L"qr/^[^,]+$/ in the window of UTF-8 code units");
+
+    std::wstring const s5 (L"xaaaay");
+    t42::wregex re5 (L"a+");
+    ts.ok (re5.exec_range (s5, m, 1, 3) == 3 && re5.exec (s5, m, 1) == 5,
+        L"qr/a+/ in the window [1, 3) with the default match mode");
+}
+
+void test52 (test::simple& ts)
+{
+    std::wstring const s (L"a1b22c333 x\nab");
+    t42::wregex re1 (L"\\d+"), re2 (L"x*"), re3 (L"ab"), re4 (L"[a-c]\\d\\d?");
+    ts.ok (re1.count (s) == 3 && re1.count (s, 2) == 2, L"qr/\\d+/ counts 3 matches");
+    ts.ok (re2.count (s) == re2.find_all (s, [] (t42::wregex::capture_list const&) {}),
+        L"qr/x*/ counts empty matches as find_all");
+    ts.ok (re3.count (s) == 1, L"qr/ab/ counts the needle");
+    ts.ok (re4.count (s) == 3, L"qr/[a-c]\\d\\d?/ counts from the starts");
+}
+
 int main (int argc, char* argv[])
 {
     std::locale::global (std::locale (""));
     std::wcout.imbue (std::locale (""));
 
-    test::simple ts (177);
+    test::simple ts (294);
 
     test1 (ts);
     test2 (ts);
@@ -727,6 +1341,28 @@ int main (int argc, char* argv[])
     test28 (ts);
     test29 (ts);
     test30 (ts);
+    test31 (ts);
+    test32 (ts);
+    test33 (ts);
+    test34 (ts);
+    test35 (ts);
+    test36 (ts);
+    test37 (ts);
+    test38 (ts);
+    test39 (ts);
+    test40 (ts);
+    test41 (ts);
+    test42 (ts);
+    test43 (ts);
+    test44 (ts);
+    test45 (ts);
+    test46 (ts);
+    test47 (ts);
+    test48 (ts);
+    test49 (ts);
+    test50 (ts);
+    test51 (ts);
+    test52 (ts);
     return ts.done_testing ();
 }
 
@@ -0,0 +1,536 @@
+// differential fuzzing of t42::wregex engines.
+//
+//      $ ./fuzzer [-n iterations] [-s seed]
+//
+// or with libFuzzer, where the input bytes drive the generator:
+//
+//      $ clang++ -std=c++11 -g -O1 -fsanitize=fuzzer,address -DT42_LIBFUZZER -I..
+//            -o libfuzzer fuzz.cpp ../t42wrecomp.cpp ../t42wreexec.cpp ../t42wredfa.cpp
+//
+// patterns are generated from the grammar in README.md, and subjects
+// are random strings over the characters the patterns talk about.
+// every engine must agree with the reference pike vm, wregex::exec with
+// an unlimited budget, which takes neither the literal nor the glushkov path.
+//
+//      exec                exec, with the literal search for plain strings
+//      test, matches       whether the vm matches, or match_longest reaches the end
+//      modes               match_earliest and match_longest as the vm
+//      nosubs              the same $0 without the captures of groups
+//      trie                the same exec at each position without the alternatives factored
+//      window              exec_range in [sp, ep) as the vm on the substring
+//      utf8, utf16, utf32  exec on the code units, captures mapped to them
+//      dfa                 wpike::dfa when the pattern is supported, 1 in 8
+//      iterator            the same matches as wregex_stream in random chunks
+//      count               the number of the matches of the iterator
+//      batch               exec_batch as the vm on each subject
+//
+// std::wregex ECMAScript is cross-checked for the match end from 0
+// with patterns in the common syntax, where subjects have no line feeds.
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <regex>
+#include <random>
+#include <iostream>
+#include <sstream>
+#include <locale>
+#include <memory>
+#include <cstdint>
+#include <cstdlib>
+#include "t42wregex.hpp"
+
+// random choices from a seeded generator or from the fuzzer input.
+class entropy {
+public:
+    explicit entropy (unsigned const seed) : rng (seed), data (nullptr), size (0) {}
+    entropy (std::uint8_t const* d, std::size_t const n) : rng (0), data (d), size (n) {}
+
+    // in [0, n)
+    unsigned operator() (unsigned const n)
+    {
+        if (n == 0)
+            return 0;
+        if (! data)
+            return rng () % n;
+        if (size == 0)
+            return 0;
+        --size;
+        return *data++ % n;
+    }
+private:
+    std::mt19937 rng;
+    std::uint8_t const* data;
+    std::size_t size;
+};
+
+// ecma restricts patterns to the syntax and the semantics
+// shared with std::wregex ECMAScript. libstdc++ stops a loop at an empty
+// iteration, where ECMAScript backtracks into the iteration for a longer one,
+// so that factors matching empty are not quantified. it matches a lookahead
+// as if the subject began there, so that assertions are not in lookaheads.
+//
+// empty is set whether the generated pattern may match empty.
+class patgen {
+public:
+    patgen (entropy& r, bool const e) : rnd (r), ecma (e), ngroup (0), look (0), nlead (0) {}
+
+    // whether the pattern has groups led by the same characters, see leads ().
+    bool led () const { return nlead > 0; }
+
+    // alternatives begin with ALT, see unmark ().
+    std::wstring regex (int const depth, bool& empty)
+    {
+        std::wstring s = ALT + cat (depth, empty);
+        while (rnd (4) == 0) {
+            bool e1;
+            s += L"|" + std::wstring (ALT) + cat (depth + 1, e1);
+            empty = empty || e1;
+        }
+        return s;
+    }
+
+    // the pattern, or with (?#) leading each alternative, the one whose
+    // alternatives are not factored into the trie, as the reference.
+    static std::wstring unmark (std::wstring const& pat, bool const plain)
+    {
+        std::wstring s;
+        for (wchar_t const c : pat)
+            if (ALT[0] != c)
+                s += c;
+            else if (plain)
+                s += L"(?#)";
+        return s;
+    }
+private:
+    static wchar_t const* const ALT;
+    entropy& rnd;
+    bool ecma;
+    int ngroup;
+    int look;
+    int nlead;
+
+    std::wstring cat (int const depth, bool& empty)
+    {
+        std::wstring s;
+        empty = true;
+        for (unsigned n = rnd (4); n > 0; --n) {
+            bool e1;
+            s += term (depth, e1);
+            empty = empty && e1;
+        }
+        return s;
+    }
+
+    std::wstring term (int const depth, bool& empty)
+    {
+        static wchar_t const* const quant[] = {
+            L"+", L"+?", L"{2}", L"{1,3}", L"{2,}", L"{1,}?",
+            L"?", L"*", L"??", L"*?", L"{0,2}?"};
+        std::wstring s = factor (depth, empty);
+        if (rnd (3) == 0 && ! (ecma && empty)) {
+            unsigned const k = rnd (sizeof (quant) / sizeof (quant[0]));
+            s += quant[k];
+            empty = empty || k >= 6;
+        }
+        return s;
+    }
+
+    // groups led by the same characters, as c(x)|a.|c(..) in a lookbehind,
+    // where their first characters are matched last.
+    std::wstring leads (int const depth)
+    {
+        static wchar_t const* const lead[] = {L"a", L"b"};
+        static wchar_t const* const tail[] = {L".", L"..", L"", L"b*"};
+        std::wstring s;
+        ++nlead;
+        for (unsigned n = 3; n > 0; --n) {
+            bool e1;
+            ++ngroup;
+            std::wstring const t = rnd (4) ? tail[rnd (4)] : cat (depth, e1);
+            s += ALT + std::wstring (lead[rnd (2)]) + L"(" + t + L")";
+            if (n > 1)
+                s += L"|";
+        }
+        return s;
+    }
+
+    std::wstring literal ()
+    {
+        static wchar_t const* const lit[] = {
+            L"a", L"b", L"c", L"x", L",", L"0", L"1", L" ", L"\\-", L"\\.", L"é", L"\\x{1F600}"};
+        return lit[rnd (ecma ? 10 : 12)];
+    }
+
+    std::wstring cclass ()
+    {
+        static wchar_t const* const item[] = {
+            L"a-c", L"x", L"0-9", L"\\d", L"\\w", L"\\s", L",", L"b",
+            L"[:alpha:]", L"[:^digit:]", L"é", L"\\W"};
+        std::wstring s (rnd (3) == 0 ? L"[^" : L"[");
+        for (unsigned n = 1 + rnd (3); n > 0; --n)
+            s += item[rnd (ecma ? 8 : 12)];
+        return s + L"]";
+    }
+
+    std::wstring factor (int const depth, bool& empty)
+    {
+        static wchar_t const* const simple[] = {
+            L".", L"\\d", L"\\w", L"\\s", L"\\D", L"\\W", L"\\S",
+            L"\\b", L"\\B", L"^", L"$", L"\\A", L"\\z"};
+        unsigned const k = rnd (depth > 2 ? 3 : ecma ? 7 : 11);
+        bool e1;
+        empty = false;
+        switch (k) {
+        case 0:
+            return literal ();
+        case 1:
+            return cclass ();
+        case 2:
+            {
+                unsigned const i = rnd (! ecma ? 13 : look > 0 ? 7 : 11);
+                empty = i >= 7;
+                return simple[i];
+            }
+        case 3:
+            ++ngroup;
+            return L"(" + regex (depth + 1, empty) + L")";
+        case 4:
+            return L"(?:" + regex (depth + 1, empty) + L")";
+        case 5:
+        case 6:
+        case 7:
+            {
+                static wchar_t const* const open[] = {L"(?=", L"(?!", L"(?<=", L"(?<!"};
+                std::wstring const s = open[k < 7 ? k - 5 : 2 + rnd (2)];
+                empty = true;
+                ++look;
+                std::wstring const t = k == 7 && rnd (2) ? leads (depth + 1) : regex (depth + 1, e1);
+                --look;
+                return s + t + L")";
+            }
+        case 8:
+            empty = true;
+            return ngroup > 0 ? L"\\" + std::to_wstring (1 + rnd (ngroup)) : literal ();
+        case 9:
+            empty = true;
+            return L"(?#c(o)m)";
+        default:
+            {
+                bool e2, e3;
+                std::wstring const s = L"(?*" + cat (depth + 1, e1) + L"|" + cat (depth + 1, e2)
+                    + L"|" + regex (depth + 1, e3) + L")";
+                empty = e1 && e3;
+                return s;
+            }
+        }
+    }
+};
+
+wchar_t const* const patgen::ALT = L"\x01";
+
+static std::wstring subject (entropy& rnd, bool const ecma)
+{
+    static wchar_t const chars[] = L"aabbc,x- _01Aé\n\U0001F600";
+    std::wstring s;
+    for (unsigned n = rnd (12); n > 0; --n)
+        s.push_back (chars[rnd (ecma ? 13 : 16)]);
+    return s;
+}
+
+static std::wstring esc (std::wstring const& s)
+{
+    std::wstring t;
+    for (wchar_t c : s)
+        if (0x20 <= c && c < 0x7f)
+            t.push_back (c);
+        else {
+            std::wostringstream x;
+            x << std::hex << static_cast<unsigned long> (c);
+            t += L"\\x{" + x.str () + L"}";
+        }
+    return t;
+}
+
+static int failures = 0;
+
+static void fail (wchar_t const* what, std::wstring const& pat, int const flag, std::wstring const& s)
+{
+    ++failures;
+    std::wcout << L"not ok - " << what << L" qr/" << esc (pat) << L"/" << (flag ? L"i" : L"")
+        << L" =~ \"" << esc (s) << L"\"" << std::endl;
+#ifdef T42_LIBFUZZER
+    std::abort ();
+#endif
+}
+
+// the code units of s, and the offsets of units for character positions.
+template<typename charT>
+static std::basic_string<charT> encode (std::wstring const& s, std::vector<std::size_t>& off);
+
+template<>
+std::basic_string<char> encode<char> (std::wstring const& s, std::vector<std::size_t>& off)
+{
+    std::string t;
+    for (wchar_t const w : s) {
+        unsigned long const c = w;
+        off.push_back (t.size ());
+        if (c < 0x80)
+            t.push_back (static_cast<char> (c));
+        else if (c < 0x800) {
+            t.push_back (static_cast<char> (0xc0 | (c >> 6)));
+            t.push_back (static_cast<char> (0x80 | (c & 0x3f)));
+        }
+        else if (c < 0x10000) {
+            t.push_back (static_cast<char> (0xe0 | (c >> 12)));
+            t.push_back (static_cast<char> (0x80 | ((c >> 6) & 0x3f)));
+            t.push_back (static_cast<char> (0x80 | (c & 0x3f)));
+        }
+        else {
+            t.push_back (static_cast<char> (0xf0 | (c >> 18)));
+            t.push_back (static_cast<char> (0x80 | ((c >> 12) & 0x3f)));
+            t.push_back (static_cast<char> (0x80 | ((c >> 6) & 0x3f)));
+            t.push_back (static_cast<char> (0x80 | (c & 0x3f)));
+        }
+    }
+    off.push_back (t.size ());
+    return t;
+}
+
+template<>
+std::basic_string<char16_t> encode<char16_t> (std::wstring const& s, std::vector<std::size_t>& off)
+{
+    std::u16string t;
+    for (wchar_t const w : s) {
+        unsigned long const c = w;
+        off.push_back (t.size ());
+        if (c < 0x10000)
+            t.push_back (static_cast<char16_t> (c));
+        else {
+            t.push_back (static_cast<char16_t> (0xd800 + ((c - 0x10000) >> 10)));
+            t.push_back (static_cast<char16_t> (0xdc00 + ((c - 0x10000) & 0x3ff)));
+        }
+    }
+    off.push_back (t.size ());
+    return t;
+}
+
+template<>
+std::basic_string<char32_t> encode<char32_t> (std::wstring const& s, std::vector<std::size_t>& off)
+{
+    std::u32string t;
+    for (wchar_t const w : s) {
+        off.push_back (t.size ());
+        t.push_back (static_cast<char32_t> (w));
+    }
+    off.push_back (t.size ());
+    return t;
+}
+
+template<typename charT>
+static bool same_units (t42::wregex const& re, std::wstring const& s, std::size_t const sp,
+    std::wstring::size_type const x, t42::wregex::capture_list const& m)
+{
+    std::vector<std::size_t> off;
+    std::basic_string<charT> const u = encode<charT> (s, off);
+    t42::wregex::capture_list mu;
+    std::wstring::size_type const xu = re.exec (u, mu, off[sp]);
+    if (xu != (x == std::wstring::npos ? x : off[x]) || mu.size () != m.size ())
+        return false;
+    for (std::size_t i = 0; i < m.size (); ++i)
+        if (mu[i] != (m[i] == std::wstring::npos ? m[i] : off[m[i]]))
+            return false;
+    return true;
+}
+
+static std::vector<t42::wregex::capture_list> stream_matches (t42::wregex const& re,
+    std::wstring const& s, entropy& rnd)
+{
+    t42::wregex_stream st (re, 1 << 16);
+    std::vector<t42::wregex::capture_list> v;
+    t42::wregex::capture_list m;
+    for (std::size_t i = 0, n; i < s.size (); i += n) {
+        n = 1 + rnd (5);
+        st.feed (s.substr (i, n));
+        while (st.next (m))
+            v.push_back (m);
+    }
+    st.finish ();
+    while (st.next (m))
+        v.push_back (m);
+    return v;
+}
+
+// positions in the window are offset by sp from those in the substring.
+static bool same_window (t42::wregex const& re, std::wstring const& s,
+    std::size_t const sp, std::size_t const ep)
+{
+    t42::wregex::capture_list m, m1;
+    std::wstring::size_type const x = re.exec (s.substr (sp, ep - sp), m, 0,
+        t42::wregex::match_default, t42::wregex::limit ());
+    std::wstring::size_type const x1 = re.exec_range (s, m1, sp, ep);
+    if ((x == std::wstring::npos) != (x1 == std::wstring::npos))
+        return false;
+    if (x == std::wstring::npos)
+        return true;
+    for (auto& i : m)
+        if (i != std::wstring::npos)
+            i += sp;
+    return m == m1;
+}
+
+// exec of re and of rp, its pattern without the trie, at each position.
+static bool same_trie (t42::wregex const& re, t42::wregex const& rp, std::wstring const& s)
+{
+    for (std::size_t i = 0; i <= s.size (); ++i) {
+        t42::wregex::capture_list m, m1;
+        if (re.exec (s, m, i) != rp.exec (s, m1, i) || m != m1)
+            return false;
+    }
+    return true;
+}
+
+static void check (entropy& rnd, bool const ecma)
+{
+    patgen gen (rnd, ecma);
+    bool empty;
+    std::wstring pat = gen.regex (0, empty);
+    // anchored at the end for the backward search of the iterator.
+    if (rnd (4) == 0)
+        pat = L"(?:" + pat + (ecma || rnd (2) ? L")$" : L")\\z");
+    std::wstring const plain = patgen::unmark (pat, true);
+    pat = patgen::unmark (pat, false);
+    int const flag = rnd (4) == 0 ? t42::wregex::icase : 0;
+    std::vector<std::wstring> subjects;
+    for (unsigned n = 4; n > 0; --n)
+        subjects.push_back (subject (rnd, ecma));
+    t42::wregex re (L""), rn (L""), rp (L"");
+    try {
+        re = t42::wregex (pat, flag);
+        rn = t42::wregex (pat, flag | t42::wregex::nosubs);
+        rp = t42::wregex (plain, flag);
+    }
+    catch (t42::regex_error const&) {
+        return;
+    }
+    // the alphabet looks at all code points for icase, posix names, and \b,
+    // so that the dfa is built for some of the patterns.
+    std::unique_ptr<t42::wpike::dfa> d;
+    if (rnd (8) == 0) {
+        d.reset (new t42::wpike::dfa (re.prog (), re.flags ()));
+        if (d->build (2000))
+            d->minimize ();
+        else
+            d.reset ();
+    }
+    bool stdre = ecma;
+    std::wregex sre;
+    if (stdre)
+        try {
+            sre.assign (pat, std::regex_constants::ECMAScript
+                | (flag ? std::regex_constants::icase : std::regex_constants::ECMAScript));
+        }
+        catch (std::regex_error const&) {
+            stdre = false;
+        }
+    // the lookbehinds of leads () see two of their alternatives
+    // only on a few subjects, so that all the short ones are tried.
+    bool done = ! gen.led ();
+    for (unsigned n = 0, end = 1; ! done && n <= 4; ++n, end *= 3)
+        for (unsigned k = 0; ! done && k < end; ++k) {
+            std::wstring s;
+            for (unsigned i = n, j = k; i > 0; --i, j /= 3)
+                s.push_back (L"xab"[j % 3]);
+            if (! same_trie (re, rp, s)) {
+                fail (L"trie", pat, flag, s);
+                done = true;
+            }
+        }
+    std::vector<t42::wregex::capture_list> mb;
+    std::vector<std::wstring::size_type> const xb = re.exec_batch (subjects, mb, 2);
+    for (std::size_t k = 0; k < subjects.size (); ++k) {
+        std::wstring const& s = subjects[k];
+        std::size_t const sp = rnd (s.size () + 1);
+        t42::wregex::capture_list m, m1;
+        t42::wregex::limit const lim;
+        std::wstring::size_type const x = re.exec (s, m, sp, t42::wregex::match_default, lim);
+        if (re.exec (s, m1, sp) != x || m1 != m)
+            fail (L"exec", pat, flag, s);
+        if (re.test (s, sp) != (x != std::wstring::npos))
+            fail (L"test", pat, flag, s);
+        if (re.matches (s) != (re.exec (s, m1, 0, t42::wregex::match_longest, lim) == s.size ()))
+            fail (L"matches", pat, flag, s);
+        for (auto mf : {t42::wregex::match_earliest, t42::wregex::match_longest}) {
+            t42::wregex::capture_list m2;
+            if (re.exec (s, m1, sp, mf) != re.exec (s, m2, sp, mf, lim) || m1 != m2)
+                fail (L"modes", pat, flag, s);
+        }
+        if (rn.exec (s, m1, sp) != x
+                || (x != std::wstring::npos && ! std::equal (m1.begin (), m1.begin () + 2, m.begin ())))
+            fail (L"nosubs", pat, flag, s);
+        if (! same_trie (re, rp, s))
+            fail (L"trie", pat, flag, s);
+        std::size_t const ep = sp + rnd (s.size () - sp + 1);
+        if (! same_window (re, s, sp, ep))
+            fail (L"window", pat, flag, s);
+        if (! same_units<char> (re, s, sp, x, m))
+            fail (L"utf8", pat, flag, s);
+        if (! same_units<char16_t> (re, s, sp, x, m))
+            fail (L"utf16", pat, flag, s);
+        if (! same_units<char32_t> (re, s, sp, x, m))
+            fail (L"utf32", pat, flag, s);
+        if (d && d->exec (s, sp) != x)
+            fail (L"dfa", pat, flag, s);
+        if (xb[k] != re.exec (s, m1, 0, t42::wregex::match_default, lim) || mb[k] != m1)
+            fail (L"batch", pat, flag, s);
+        std::vector<t42::wregex::capture_list> v;
+        for (t42::wregex::iterator it (re, s), end; it != end; ++it)
+            v.push_back (*it);
+        if (v != stream_matches (re, s, rnd))
+            fail (L"iterator", pat, flag, s);
+        if (re.count (s) != v.size ())
+            fail (L"count", pat, flag, s);
+        if (stdre) {
+            std::wsmatch sm;
+            std::wstring::size_type const y
+                = std::regex_search (s, sm, sre, std::regex_constants::match_continuous)
+                ? sm.length (0) : std::wstring::npos;
+            if (y != re.exec (s, m1, 0))
+                fail (L"std::wregex", pat, flag, s);
+        }
+    }
+}
+
+#ifdef T42_LIBFUZZER
+extern "C" int LLVMFuzzerTestOneInput (std::uint8_t const* data, std::size_t size)
+{
+    static bool ready = false;
+    if (! ready) {
+        std::locale::global (std::locale (""));
+        ready = true;
+    }
+    if (size == 0)
+        return 0;
+    entropy rnd (data + 1, size - 1);
+    check (rnd, data[0] & 1);
+    return 0;
+}
+#else
+int main (int argc, char* argv[])
+{
+    std::locale::global (std::locale (""));
+    std::wcout.imbue (std::locale (""));
+    unsigned long n = 10000;
+    unsigned seed = 1;
+    for (int i = 1; i + 1 < argc; i += 2)
+        if (std::string ("-n") == argv[i])
+            n = std::strtoul (argv[i + 1], nullptr, 10);
+        else if (std::string ("-s") == argv[i])
+            seed = std::strtoul (argv[i + 1], nullptr, 10);
+    entropy rnd (seed);
+    for (unsigned long i = 0; i < n; ++i)
+        check (rnd, i % 2 == 0);
+    std::wcout << (failures ? L"not ok" : L"ok") << L" - " << n << L" patterns, "
+        << failures << L" failures" << std::endl;
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif
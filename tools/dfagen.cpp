@@ -0,0 +1,61 @@
+// generate C++ sources of DFAs for fixed patterns.
+//
+//      $ dfagen [-i] name pattern [[-i] name pattern ...] > rules.cpp
+//
+// each pattern in UTF-8 becomes the function
+//      std::wstring::size_type name (std::wstring const& s, std::wstring::size_type sp)
+// returning the end of the leftmost-first match from sp, or npos.
+// -i ignores case in the following patterns.
+#include <string>
+#include <vector>
+#include <iostream>
+#include <locale>
+#include <cstdlib>
+#include "t42wregex.hpp"
+
+int main (int argc, char* argv[])
+{
+    std::locale::global (std::locale (""));
+    // the options are parsed in a loop before the name of each pattern.
+    struct rule {
+        char const* name;
+        char const* pattern;
+        t42::wregex::flag_type flag;
+    };
+    std::vector<rule> rules;
+    t42::wregex::flag_type flag = 0;
+    bool ok = true;
+    for (int i = 1; ok && i < argc; ) {
+        if (std::string ("-i") == argv[i]) {
+            flag = t42::wregex::icase;
+            ++i;
+        }
+        else if (argv[i][0] == '-' || i + 1 >= argc)
+            ok = false;
+        else {
+            rules.push_back (rule{argv[i], argv[i + 1], flag});
+            i += 2;
+        }
+    }
+    if (! ok || rules.empty ()) {
+        std::cerr << "usage: dfagen [-i] name pattern [[-i] name pattern ...]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    for (rule const& r : rules) {
+        try {
+            t42::wregex re (std::string (r.pattern), r.flag);
+            t42::wpike::dfa d (re.prog (), re.flags ());
+            if (! d.build ()) {
+                std::cerr << "dfagen: " << r.name << ": not supported" << std::endl;
+                return EXIT_FAILURE;
+            }
+            d.minimize ();
+            std::cout << d.emit_cpp (r.name) << std::endl;
+        }
+        catch (t42::regex_error const&) {
+            std::cerr << "dfagen: " << r.name << ": syntax error" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}